@@ -0,0 +1,460 @@
+/***************************************************************************
+*
+* Copyright (c) 2020 jackszhang, All Rights Reserved
+*
+* @file    aes.cpp
+* @author  jackszhang
+* @date    2020/11/08
+* @brief   The interface of aes
+*
+**************************************************************************/
+
+#include "aes.h"
+#include <string>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace dailycode {
+
+// 8x8位矩阵转置：第j个字节的第i位与第i个字节的第j位互换
+static inline uint64_t transposeBits8x8(uint64_t x) {
+    uint64_t t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+// 8个uint64组成的8x8字节矩阵转置：rows[i]的第k个字节与rows[k]的第i个字节互换
+static inline void transposeBytes8x8(uint64_t* rows) {
+    for (int k = 0; k < 4; ++k) {
+        uint64_t a = rows[k];
+        uint64_t b = rows[k + 4];
+        rows[k] = (a & 0x00000000FFFFFFFFULL) | (b << 32);
+        rows[k + 4] = (a >> 32) | (b & 0xFFFFFFFF00000000ULL);
+    }
+    for (int k = 0; k < 8; k += (k & 1) ? 3 : 1) {
+        uint64_t a = rows[k];
+        uint64_t b = rows[k + 2];
+        rows[k] = (a & 0x0000FFFF0000FFFFULL) | ((b & 0x0000FFFF0000FFFFULL) << 16);
+        rows[k + 2] = ((a >> 16) & 0x0000FFFF0000FFFFULL) | (b & 0xFFFF0000FFFF0000ULL);
+    }
+    for (int k = 0; k < 8; k += 2) {
+        uint64_t a = rows[k];
+        uint64_t b = rows[k + 1];
+        rows[k] = (a & 0x00FF00FF00FF00FFULL) | ((b & 0x00FF00FF00FF00FFULL) << 8);
+        rows[k + 1] = ((a >> 8) & 0x00FF00FF00FF00FFULL) | (b & 0xFF00FF00FF00FF00ULL);
+    }
+}
+
+// AES S盒的Boyar-Peralta电路，q[i]为所有字节第i位组成的位平面，只有与、异或运算，
+// 没有查表，耗时与数据无关
+static void sboxBitsliced(uint64_t* q) {
+    uint64_t x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4];
+    uint64_t x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+    // 输入线性变换
+    uint64_t y14 = x3 ^ x5;
+    uint64_t y13 = x0 ^ x6;
+    uint64_t y9 = x0 ^ x3;
+    uint64_t y8 = x0 ^ x5;
+    uint64_t t0 = x1 ^ x2;
+    uint64_t y1 = t0 ^ x7;
+    uint64_t y4 = y1 ^ x3;
+    uint64_t y12 = y13 ^ y14;
+    uint64_t y2 = y1 ^ x0;
+    uint64_t y5 = y1 ^ x6;
+    uint64_t y3 = y5 ^ y8;
+    uint64_t t1 = x4 ^ y12;
+    uint64_t y15 = t1 ^ x5;
+    uint64_t y20 = t1 ^ x1;
+    uint64_t y6 = y15 ^ x7;
+    uint64_t y10 = y15 ^ t0;
+    uint64_t y11 = y20 ^ y9;
+    uint64_t y7 = x7 ^ y11;
+    uint64_t y17 = y10 ^ y11;
+    uint64_t y19 = y10 ^ y8;
+    uint64_t y16 = t0 ^ y11;
+    uint64_t y21 = y13 ^ y16;
+    uint64_t y18 = x0 ^ y16;
+
+    // GF(2^8)求逆
+    uint64_t t2 = y12 & y15;
+    uint64_t t3 = y3 & y6;
+    uint64_t t4 = t3 ^ t2;
+    uint64_t t5 = y4 & x7;
+    uint64_t t6 = t5 ^ t2;
+    uint64_t t7 = y13 & y16;
+    uint64_t t8 = y5 & y1;
+    uint64_t t9 = t8 ^ t7;
+    uint64_t t10 = y2 & y7;
+    uint64_t t11 = t10 ^ t7;
+    uint64_t t12 = y9 & y11;
+    uint64_t t13 = y14 & y17;
+    uint64_t t14 = t13 ^ t12;
+    uint64_t t15 = y8 & y10;
+    uint64_t t16 = t15 ^ t12;
+    uint64_t t17 = t4 ^ t14;
+    uint64_t t18 = t6 ^ t16;
+    uint64_t t19 = t9 ^ t14;
+    uint64_t t20 = t11 ^ t16;
+    uint64_t t21 = t17 ^ y20;
+    uint64_t t22 = t18 ^ y19;
+    uint64_t t23 = t19 ^ y21;
+    uint64_t t24 = t20 ^ y18;
+
+    uint64_t t25 = t21 ^ t22;
+    uint64_t t26 = t21 & t23;
+    uint64_t t27 = t24 ^ t26;
+    uint64_t t28 = t25 & t27;
+    uint64_t t29 = t28 ^ t22;
+    uint64_t t30 = t23 ^ t24;
+    uint64_t t31 = t22 ^ t26;
+    uint64_t t32 = t31 & t30;
+    uint64_t t33 = t32 ^ t24;
+    uint64_t t34 = t23 ^ t33;
+    uint64_t t35 = t27 ^ t33;
+    uint64_t t36 = t24 & t35;
+    uint64_t t37 = t36 ^ t34;
+    uint64_t t38 = t27 ^ t36;
+    uint64_t t39 = t29 & t38;
+    uint64_t t40 = t25 ^ t39;
+
+    uint64_t t41 = t40 ^ t37;
+    uint64_t t42 = t29 ^ t33;
+    uint64_t t43 = t29 ^ t40;
+    uint64_t t44 = t33 ^ t37;
+    uint64_t t45 = t42 ^ t41;
+    uint64_t z0 = t44 & y15;
+    uint64_t z1 = t37 & y6;
+    uint64_t z2 = t33 & x7;
+    uint64_t z3 = t43 & y16;
+    uint64_t z4 = t40 & y1;
+    uint64_t z5 = t29 & y7;
+    uint64_t z6 = t42 & y11;
+    uint64_t z7 = t45 & y17;
+    uint64_t z8 = t41 & y10;
+    uint64_t z9 = t44 & y12;
+    uint64_t z10 = t37 & y3;
+    uint64_t z11 = t33 & y4;
+    uint64_t z12 = t43 & y13;
+    uint64_t z13 = t40 & y5;
+    uint64_t z14 = t29 & y2;
+    uint64_t z15 = t42 & y9;
+    uint64_t z16 = t45 & y14;
+    uint64_t z17 = t41 & y8;
+
+    // 输出线性变换
+    uint64_t t46 = z15 ^ z16;
+    uint64_t t47 = z10 ^ z11;
+    uint64_t t48 = z5 ^ z13;
+    uint64_t t49 = z9 ^ z10;
+    uint64_t t50 = z2 ^ z12;
+    uint64_t t51 = z2 ^ z5;
+    uint64_t t52 = z7 ^ z8;
+    uint64_t t53 = z0 ^ z3;
+    uint64_t t54 = z6 ^ z7;
+    uint64_t t55 = z16 ^ z17;
+    uint64_t t56 = z12 ^ t48;
+    uint64_t t57 = t50 ^ t53;
+    uint64_t t58 = z4 ^ t46;
+    uint64_t t59 = z3 ^ t54;
+    uint64_t t60 = t46 ^ t57;
+    uint64_t t61 = z14 ^ t57;
+    uint64_t t62 = t52 ^ t58;
+    uint64_t t63 = t49 ^ t58;
+    uint64_t t64 = z4 ^ t59;
+    uint64_t t65 = t61 ^ t62;
+    uint64_t t66 = z1 ^ t63;
+    uint64_t s0 = t59 ^ t63;
+    uint64_t s6 = t56 ^ ~t62;
+    uint64_t s7 = t48 ^ ~t60;
+    uint64_t t67 = t64 ^ t65;
+    uint64_t s3 = t53 ^ t66;
+    uint64_t s4 = t51 ^ t66;
+    uint64_t s5 = t47 ^ t65;
+    uint64_t s1 = t64 ^ ~s3;
+    uint64_t s2 = t55 ^ ~t67;
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+// 对64字节同时做SubBytes：先转置成8个位平面，过电路后再转置回来
+static void subBytes64(unsigned char* data) {
+    uint64_t rows[8];
+    memcpy(rows, data, sizeof(rows));
+    for (int k = 0; k < 8; ++k) {
+        rows[k] = transposeBits8x8(rows[k]);
+    }
+    transposeBytes8x8(rows);
+    sboxBitsliced(rows);
+    transposeBytes8x8(rows);
+    for (int k = 0; k < 8; ++k) {
+        rows[k] = transposeBits8x8(rows[k]);
+    }
+    memcpy(data, rows, sizeof(rows));
+}
+
+static inline uint32_t xtime32(uint32_t x) {
+    return ((x & 0x7f7f7f7fU) << 1) ^ (((x >> 7) & 0x01010101U) * 0x1b);
+}
+
+static inline uint32_t rotr32(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+// 状态按列存放，state[r + 4 * c]为第r行第c列
+static void shiftRows(unsigned char* state) {
+    unsigned char tmp[kAesBlockSize];
+    memcpy(tmp, state, sizeof(tmp));
+    for (int c = 0; c < 4; ++c) {
+        for (int r = 1; r < 4; ++r) {
+            state[r + 4 * c] = tmp[r + 4 * ((c + r) & 3)];
+        }
+    }
+}
+
+static void mixColumns(unsigned char* state) {
+    for (int c = 0; c < 4; ++c) {
+        unsigned char* col = state + 4 * c;
+        uint32_t w = (uint32_t)col[0] | ((uint32_t)col[1] << 8) | ((uint32_t)col[2] << 16) |
+                     ((uint32_t)col[3] << 24);
+        uint32_t r8 = rotr32(w, 8);
+        w = xtime32(w ^ r8) ^ r8 ^ rotr32(w, 16) ^ rotr32(w, 24);
+        col[0] = (unsigned char)w;
+        col[1] = (unsigned char)(w >> 8);
+        col[2] = (unsigned char)(w >> 16);
+        col[3] = (unsigned char)(w >> 24);
+    }
+}
+
+// 第block个计数器块：iv按128位大端整数加block
+static void counterBlock(unsigned char* out, const unsigned char* iv, uint64_t block) {
+    uint64_t carry = block;
+    for (int i = kAesBlockSize - 1; i >= 0; --i) {
+        uint64_t sum = (uint64_t)iv[i] + (carry & 0xff);
+        out[i] = (unsigned char)sum;
+        carry = (carry >> 8) + (sum >> 8);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("aes,ssse3"))) static void aesCtrNi(
+    unsigned char* dst, const unsigned char* src, const unsigned char* roundKeys, int rounds,
+    const unsigned char* iv, uint64_t block, size_t blockCnt) {
+    __m128i rk[kAesMaxRounds + 1];
+    for (int r = 0; r <= rounds; ++r) {
+        rk[r] = _mm_loadu_si128((const __m128i*)(roundKeys + r * kAesBlockSize));
+    }
+    // 计数器在寄存器中按主机序的两个64位整数相加，使用前再翻转成大端
+    const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+    for (int i = 0; i < 8; ++i) {
+        hi = (hi << 8) | iv[i];
+        lo = (lo << 8) | iv[8 + i];
+    }
+    lo += block;
+    hi += (lo < block) ? 1 : 0;
+
+    size_t done = 0;
+    while (done < blockCnt) {
+        size_t n = std::min(blockCnt - done, (size_t)kAesLanes);
+        __m128i x[kAesLanes];
+        for (size_t k = 0; k < n; ++k) {
+            x[k] = _mm_xor_si128(_mm_shuffle_epi8(_mm_set_epi64x((long long)hi, (long long)lo),
+                                                  reverse),
+                                 rk[0]);
+            if (++lo == 0) {
+                ++hi;
+            }
+        }
+        if (n == kAesLanes) {
+            // 8个块相互独立，每轮交替发射，隐藏aesenc的延迟
+            for (int r = 1; r < rounds; ++r) {
+                x[0] = _mm_aesenc_si128(x[0], rk[r]);
+                x[1] = _mm_aesenc_si128(x[1], rk[r]);
+                x[2] = _mm_aesenc_si128(x[2], rk[r]);
+                x[3] = _mm_aesenc_si128(x[3], rk[r]);
+                x[4] = _mm_aesenc_si128(x[4], rk[r]);
+                x[5] = _mm_aesenc_si128(x[5], rk[r]);
+                x[6] = _mm_aesenc_si128(x[6], rk[r]);
+                x[7] = _mm_aesenc_si128(x[7], rk[r]);
+            }
+        } else {
+            for (int r = 1; r < rounds; ++r) {
+                for (size_t k = 0; k < n; ++k) {
+                    x[k] = _mm_aesenc_si128(x[k], rk[r]);
+                }
+            }
+        }
+        for (size_t k = 0; k < n; ++k) {
+            size_t pos = (done + k) * kAesBlockSize;
+            __m128i stream = _mm_aesenclast_si128(x[k], rk[rounds]);
+            __m128i data = _mm_loadu_si128((const __m128i*)(src + pos));
+            _mm_storeu_si128((__m128i*)(dst + pos), _mm_xor_si128(data, stream));
+        }
+        done += n;
+    }
+}
+#endif
+
+static bool detectAesNi() {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes") && __builtin_cpu_supports("ssse3");
+#else
+    return false;
+#endif
+}
+
+Aes::Aes() : m_rounds(0) {
+    static const bool hasNi = detectAesNi();
+    m_useNi = hasNi;
+    memset(m_roundKeys, 0, sizeof(m_roundKeys));
+    setKey((const unsigned char*)"", 0);
+}
+
+void Aes::setKey(const unsigned char* key, int byte_length) {
+    m_key = std::string((const char*)key, byte_length);
+
+    unsigned char material[32];
+    memset(material, 0, sizeof(material));
+    int keyLen = byte_length <= 16 ? 16 : 32;
+    for (int i = 0; i < byte_length; ++i) {
+        material[i % 32] ^= key[i];
+    }
+
+    // FIPS-197密钥扩展，按4字节的字处理
+    int nk = keyLen / 4;
+    m_rounds = nk + 6;
+    int words = 4 * (m_rounds + 1);
+    unsigned char* w = m_roundKeys;
+    memcpy(w, material, keyLen);
+    unsigned char rcon = 0x01;
+    for (int i = nk; i < words; ++i) {
+        unsigned char temp[64];
+        memset(temp, 0, sizeof(temp));
+        memcpy(temp, w + (i - 1) * 4, 4);
+        if (i % nk == 0) {
+            unsigned char first = temp[0];
+            memmove(temp, temp + 1, 3);
+            temp[3] = first;
+            subBytes64(temp);
+            temp[0] ^= rcon;
+            rcon = (unsigned char)((rcon << 1) ^ ((rcon >> 7) * 0x1b));
+        } else if (nk > 6 && i % nk == 4) {
+            subBytes64(temp);
+        }
+        for (int j = 0; j < 4; ++j) {
+            w[i * 4 + j] = w[(i - nk) * 4 + j] ^ temp[j];
+        }
+    }
+}
+
+void Aes::encrypt(unsigned char* dst, const unsigned char* src, int byte_length) {
+    static const unsigned char zeroIv[kEncryptIvLen] = {0};
+    cryptStream(dst, src, byte_length, zeroIv, 0);
+}
+
+void Aes::decrypt(unsigned char* dst, const unsigned char* src, int byte_length) {
+    static const unsigned char zeroIv[kEncryptIvLen] = {0};
+    cryptStream(dst, src, byte_length, zeroIv, 0);
+}
+
+void Aes::cryptStream(unsigned char* dst, const unsigned char* src, int byte_length,
+                      const unsigned char* iv, uint64_t offset) {
+    if (byte_length <= 0) {
+        return;
+    }
+    size_t len = (size_t)byte_length;
+    uint64_t block = offset / kAesBlockSize;
+    size_t skip = offset % kAesBlockSize;
+    size_t i = 0;
+    unsigned char stream[kAesBlockSize];
+    static const unsigned char zeroBlock[kAesBlockSize] = {0};
+
+    // 起始偏移不在块边界上时，第一个块只用后半部分密钥流
+    if (skip > 0) {
+        cryptBlocks(stream, zeroBlock, iv, block, 1);
+        for (; skip < kAesBlockSize && i < len; ++skip, ++i) {
+            dst[i] = src[i] ^ stream[skip];
+        }
+        ++block;
+    }
+
+    size_t fullCnt = (len - i) / kAesBlockSize;
+    if (fullCnt > 0) {
+        cryptBlocks(dst + i, src + i, iv, block, fullCnt);
+        i += fullCnt * kAesBlockSize;
+        block += fullCnt;
+    }
+
+    if (i < len) {
+        cryptBlocks(stream, zeroBlock, iv, block, 1);
+        for (size_t j = 0; i < len; ++i, ++j) {
+            dst[i] = src[i] ^ stream[j];
+        }
+    }
+}
+
+void Aes::cryptBlocks(unsigned char* dst, const unsigned char* src, const unsigned char* iv,
+                      uint64_t block, size_t blockCnt) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (m_useNi) {
+        aesCtrNi(dst, src, m_roundKeys, m_rounds, iv, block, blockCnt);
+        return;
+    }
+#endif
+    cryptBlocksSoft(dst, src, iv, block, blockCnt);
+}
+
+void Aes::cryptBlocksSoft(unsigned char* dst, const unsigned char* src, const unsigned char* iv,
+                          uint64_t block, size_t blockCnt) {
+    unsigned char state[kAesSoftLanes * kAesBlockSize];
+    size_t done = 0;
+    while (done < blockCnt) {
+        // 不足kAesSoftLanes个块时多算的部分直接丢弃
+        size_t n = std::min(blockCnt - done, (size_t)kAesSoftLanes);
+        for (size_t k = 0; k < kAesSoftLanes; ++k) {
+            unsigned char* s = state + k * kAesBlockSize;
+            counterBlock(s, iv, block + done + k);
+            for (int j = 0; j < kAesBlockSize; ++j) {
+                s[j] ^= m_roundKeys[j];
+            }
+        }
+        for (int r = 1; r <= m_rounds; ++r) {
+            subBytes64(state);
+            const unsigned char* rk = m_roundKeys + r * kAesBlockSize;
+            for (size_t k = 0; k < kAesSoftLanes; ++k) {
+                unsigned char* s = state + k * kAesBlockSize;
+                shiftRows(s);
+                if (r < m_rounds) {
+                    mixColumns(s);
+                }
+                for (int j = 0; j < kAesBlockSize; ++j) {
+                    s[j] ^= rk[j];
+                }
+            }
+        }
+        size_t bytes = n * kAesBlockSize;
+        size_t pos = done * kAesBlockSize;
+        for (size_t j = 0; j < bytes; ++j) {
+            dst[pos + j] = src[pos + j] ^ state[j];
+        }
+        done += n;
+    }
+}
+
+}  // end namespace dailycode
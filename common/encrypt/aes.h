@@ -0,0 +1,53 @@
+/***************************************************************************
+*
+* Copyright (c) 2020 jackszhang, All Rights Reserved
+*
+* @file    aes.h
+* @author  jackszhang
+* @date    2020/11/08
+* @brief   The interface of aes
+*
+**************************************************************************/
+#pragma once
+
+#include "encrypt.h"
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace dailycode {
+
+#define kAesBlockSize 16
+#define kAesMaxRounds 14
+#define kAesLanes 8      // AES-NI流水线一次处理的块数
+#define kAesSoftLanes 4  // 软件实现一次处理的块数，正好凑成64字节做位切片
+
+// AES-CTR：
+// 1. key不超过16字节时补0作为AES-128，否则作为AES-256，超过32字节的部分循环异或进前32字节
+// 2. 计数器块为iv + n(按128位大端整数相加)，与通用的AES-CTR实现兼容
+// 3. CPU支持AES-NI时使用硬件指令，否则使用不查表的常数时间软件实现
+class Aes : public baseEncrypt {
+ public:
+    Aes();
+
+    virtual void setKey(const unsigned char* key, int byte_length);
+    // encrypt/decrypt为全0 iv的CTR流，长度任意，两者是同一个操作
+    virtual void encrypt(unsigned char* dst, const unsigned char* src, int byte_length);
+    virtual void decrypt(unsigned char* dst, const unsigned char* src, int byte_length);
+    virtual void cryptStream(unsigned char* dst, const unsigned char* src, int byte_length,
+                             const unsigned char* iv, uint64_t offset);
+
+ private:
+    // 从第block个计数器块开始处理blockCnt个完整的块
+    void cryptBlocks(unsigned char* dst, const unsigned char* src, const unsigned char* iv,
+                     uint64_t block, size_t blockCnt);
+    void cryptBlocksSoft(unsigned char* dst, const unsigned char* src, const unsigned char* iv,
+                         uint64_t block, size_t blockCnt);
+
+ private:
+    unsigned char m_roundKeys[(kAesMaxRounds + 1) * kAesBlockSize];
+    int m_rounds;
+    bool m_useNi;
+};
+
+}  // end namespace dailycode
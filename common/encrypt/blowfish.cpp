@@ -13,6 +13,8 @@
 #include <string>
 #include <string.h>
 #include <algorithm>
+#include <thread>
+#include <vector>
 
 #if !defined(__LITTLE_ENDIAN__) and !defined(__BIG_ENDIAN__)
 #define __LITTLE_ENDIAN__
@@ -275,6 +277,111 @@ void Blowfish::decrypt(unsigned char* dst, const unsigned char* src, int byte_le
     }
 }
 
+// CTR模式：第n个8字节块的密钥流为E(iv[0..7] ^ (iv[8..15] + n))
+// 各块互不依赖，大块数据按kBlowfishLanes对齐切分到多个线程并行处理
+void Blowfish::cryptStream(unsigned char* dst, const unsigned char* src, int byte_length,
+                           const unsigned char* iv, uint64_t offset) {
+    if (byte_length <= 0) {
+        return;
+    }
+    uint64_t nonce = 0;
+    uint64_t counter = 0;
+    memcpy(&nonce, iv, sizeof(nonce));
+    memcpy(&counter, iv + sizeof(nonce), sizeof(counter));
+
+    size_t total = (size_t)byte_length;
+    size_t threadCnt = 1;
+    if (total >= kBlowfishParallelMinSize) {
+        threadCnt = std::min((size_t)std::thread::hardware_concurrency(),
+                             (size_t)kBlowfishMaxThreads);
+        threadCnt = std::max(std::min(threadCnt, total / (kBlowfishParallelMinSize / 2)),
+                             (size_t)1);
+    }
+    if (threadCnt <= 1) {
+        cryptRange(dst, src, total, nonce, counter, offset);
+        return;
+    }
+
+    // 每段长度按交织的块组对齐，除第一段外每段都从完整的块组开始
+    const size_t groupSize = kBlowfishBlockSize * kBlowfishLanes;
+    size_t chunk = (total / threadCnt + groupSize - 1) / groupSize * groupSize;
+    std::vector<std::thread> workers;
+    workers.reserve(threadCnt - 1);
+    for (size_t begin = chunk; begin < total; begin += chunk) {
+        size_t len = std::min(chunk, total - begin);
+        workers.push_back(std::thread([=]() {
+            cryptRange(dst + begin, src + begin, len, nonce, counter, offset + begin);
+        }));
+    }
+    cryptRange(dst, src, std::min(chunk, total), nonce, counter, offset);
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+}
+
+void Blowfish::cryptRange(unsigned char* dst, const unsigned char* src, size_t len,
+                          uint64_t nonce, uint64_t counter, uint64_t offset) {
+    uint64_t block = offset / kBlowfishBlockSize;
+    size_t skip = offset % kBlowfishBlockSize;
+    uint32_t left[kBlowfishLanes];
+    uint32_t right[kBlowfishLanes];
+    unsigned char stream[kBlowfishBlockSize * kBlowfishLanes];
+    size_t i = 0;
+
+    // 起始偏移不在块边界上时，先单独处理第一个块的剩余部分
+    if (skip > 0) {
+        uint64_t input = nonce ^ (counter + block);
+        uint32_t l = (uint32_t)input;
+        uint32_t r = (uint32_t)(input >> 32);
+        encryptBlock(&l, &r);
+        memcpy(stream, &l, sizeof(l));
+        memcpy(stream + sizeof(l), &r, sizeof(r));
+        for (; skip < kBlowfishBlockSize && i < len; ++skip, ++i) {
+            dst[i] = src[i] ^ stream[skip];
+        }
+        ++block;
+    }
+
+    // 每次生成kBlowfishLanes个块的密钥流，尾部不足时只使用需要的部分
+    while (i < len) {
+        for (int k = 0; k < kBlowfishLanes; ++k) {
+            uint64_t input = nonce ^ (counter + block + k);
+            left[k] = (uint32_t)input;
+            right[k] = (uint32_t)(input >> 32);
+        }
+        encryptBlocks(left, right);
+        for (int k = 0; k < kBlowfishLanes; ++k) {
+            memcpy(stream + k * kBlowfishBlockSize, &left[k], sizeof(uint32_t));
+            memcpy(stream + k * kBlowfishBlockSize + sizeof(uint32_t), &right[k],
+                   sizeof(uint32_t));
+        }
+        size_t n = std::min(sizeof(stream), len - i);
+        for (size_t j = 0; j < n; ++j) {
+            dst[i + j] = src[i + j] ^ stream[j];
+        }
+        i += n;
+        block += kBlowfishLanes;
+    }
+}
+
+// 与encryptBlock相同的16轮运算，kBlowfishLanes个块在同一轮内交替计算，
+// 相互独立的查表和加法可以在流水线中重叠执行，而不是等一个块的16轮依赖链走完
+void Blowfish::encryptBlocks(uint32_t* left, uint32_t* right) {
+    for (int i = 0; i < 16; ++i) {
+        uint32_t key = m_pary_[i];
+        for (int k = 0; k < kBlowfishLanes; ++k) {
+            uint32_t value = left[k] ^ key;
+            left[k] = right[k] ^ feistel(value);
+            right[k] = value;
+        }
+    }
+    for (int k = 0; k < kBlowfishLanes; ++k) {
+        uint32_t value = left[k];
+        left[k] = right[k] ^ m_pary_[17];
+        right[k] = value ^ m_pary_[16];
+    }
+}
+
 void Blowfish::encryptBlock(uint32_t* left, uint32_t* right) {
     for (int i = 0; i < 16; ++i) {
         *left ^= m_pary_[i];
@@ -302,13 +409,11 @@ void Blowfish::decryptBlock(uint32_t* left, uint32_t* right) {
 }
 
 uint32_t Blowfish::feistel(uint32_t value) {
-    Converter32 converter;
-    converter.bit_32 = value;
-
-    uint8_t a = converter.bit_8.byte0;
-    uint8_t b = converter.bit_8.byte1;
-    uint8_t c = converter.bit_8.byte2;
-    uint8_t d = converter.bit_8.byte3;
+    // 与Converter32取字节的顺序一致，byte0为最高字节，移位取值避免经过内存
+    uint8_t a = (uint8_t)(value >> 24);
+    uint8_t b = (uint8_t)(value >> 16);
+    uint8_t c = (uint8_t)(value >> 8);
+    uint8_t d = (uint8_t)value;
 
     return ((m_sbox_[0][a] + m_sbox_[1][b]) ^ m_sbox_[2][c]) + m_sbox_[3][d];
 }
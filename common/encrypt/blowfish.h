@@ -16,16 +16,28 @@
 
 namespace dailycode {
 
+#define kBlowfishBlockSize 8
+#define kBlowfishLanes 8                          // CTR模式下交织计算的块数
+#define kBlowfishParallelMinSize (256 * 1024)     // 超过该长度才拆分到多个线程
+#define kBlowfishMaxThreads 4
+
 class Blowfish : public baseEncrypt {
  public:
     virtual void setKey(const unsigned char* key, int byte_length);
     virtual void encrypt(unsigned char* dst, const unsigned char* src, int byte_length);
     virtual void decrypt(unsigned char* dst, const unsigned char* src, int byte_length);
+    virtual void cryptStream(unsigned char* dst, const unsigned char* src, int byte_length,
+                             const unsigned char* iv, uint64_t offset);
 
  private:
     void encryptBlock(uint32_t* left, uint32_t* right);
+    // 同时加密kBlowfishLanes个块
+    void encryptBlocks(uint32_t* left, uint32_t* right);
+    // 处理[offset, offset+len)范围内的CTR流
+    void cryptRange(unsigned char* dst, const unsigned char* src, size_t len, uint64_t nonce,
+                    uint64_t counter, uint64_t offset);
     void decryptBlock(uint32_t* left, uint32_t* right);
-    uint32_t feistel(uint32_t value);
+    inline uint32_t feistel(uint32_t value);
 
  private:
     uint32_t m_pary_[18];
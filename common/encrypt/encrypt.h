@@ -15,11 +15,18 @@
 
 namespace dailycode {
 
+#define kEncryptIvLen 16
+
 class baseEncrypt {
  public:
+    virtual ~baseEncrypt() {}
     virtual void setKey(const unsigned char* key, int byte_length) = 0;
     virtual void encrypt(unsigned char* dst, const unsigned char* src, int byte_length) = 0;
     virtual void decrypt(unsigned char* dst, const unsigned char* src, int byte_length) = 0;
+    // 流式加解密：由key和iv生成密钥流与数据异或，长度任意，加密和解密是同一个操作；
+    // offset为src在整个流中的偏移，可以从任意位置开始处理
+    virtual void cryptStream(unsigned char* dst, const unsigned char* src, int byte_length,
+                             const unsigned char* iv, uint64_t offset) = 0;
     virtual std::string getKey() { return m_key; }
 
  public:
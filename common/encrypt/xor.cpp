@@ -14,34 +14,167 @@
 #include <string.h>
 #include <algorithm>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 namespace dailycode {
 
+// 按CPU支持的指令集选择的异或内核：dst = src ^ stream ^ ivStream，
+// ivStream为按16字节循环的64字节，长度为16的倍数的向量都可以直接使用
+typedef void (*XorKernel)(unsigned char* dst, const unsigned char* src,
+                          const unsigned char* stream, const unsigned char* ivStream, size_t len);
+
+static void xorScalar(unsigned char* dst, const unsigned char* src, const unsigned char* stream,
+                      const unsigned char* ivStream, size_t len) {
+    uint64_t ivWord[2];
+    memcpy(ivWord, ivStream, sizeof(ivWord));
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        uint64_t data[2];
+        uint64_t key[2];
+        memcpy(data, src + i, sizeof(data));
+        memcpy(key, stream + i, sizeof(key));
+        data[0] ^= key[0] ^ ivWord[0];
+        data[1] ^= key[1] ^ ivWord[1];
+        memcpy(dst + i, data, sizeof(data));
+    }
+    for (; i < len; ++i) {
+        dst[i] = src[i] ^ stream[i] ^ ivStream[i & 15];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2"))) static void xorSse2(unsigned char* dst, const unsigned char* src,
+                                                    const unsigned char* stream,
+                                                    const unsigned char* ivStream, size_t len) {
+    __m128i ivVec = _mm_loadu_si128((const __m128i*)ivStream);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i data = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i key = _mm_loadu_si128((const __m128i*)(stream + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(data, _mm_xor_si128(key, ivVec)));
+    }
+    xorScalar(dst + i, src + i, stream + i, ivStream, len - i);
+}
+
+__attribute__((target("avx2"))) static void xorAvx2(unsigned char* dst, const unsigned char* src,
+                                                    const unsigned char* stream,
+                                                    const unsigned char* ivStream, size_t len) {
+    __m256i ivVec = _mm256_loadu_si256((const __m256i*)ivStream);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i data = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i key = _mm256_loadu_si256((const __m256i*)(stream + i));
+        _mm256_storeu_si256((__m256i*)(dst + i),
+                            _mm256_xor_si256(data, _mm256_xor_si256(key, ivVec)));
+    }
+    xorScalar(dst + i, src + i, stream + i, ivStream, len - i);
+}
+
+__attribute__((target("avx512f"))) static void xorAvx512(unsigned char* dst,
+                                                         const unsigned char* src,
+                                                         const unsigned char* stream,
+                                                         const unsigned char* ivStream,
+                                                         size_t len) {
+    __m512i ivVec = _mm512_loadu_si512((const void*)ivStream);
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i data = _mm512_loadu_si512((const void*)(src + i));
+        __m512i key = _mm512_loadu_si512((const void*)(stream + i));
+        _mm512_storeu_si512((void*)(dst + i), _mm512_xor_si512(data, _mm512_xor_si512(key, ivVec)));
+    }
+    xorScalar(dst + i, src + i, stream + i, ivStream, len - i);
+}
+#endif
+
+static XorKernel selectXorKernel() {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return xorAvx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return xorAvx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return xorSse2;
+    }
+#endif
+    return xorScalar;
+}
+
+static size_t gcdSize(size_t a, size_t b) {
+    while (b != 0) {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
 void Xor::setKey(const unsigned char* key, int byte_length) {
     m_key = std::string((const char*)key, byte_length);
-}
 
-void Xor::encrypt(unsigned char* dst, const unsigned char* src, int byte_length) {
-    if (dst != src) {
-        memcpy(dst, src, byte_length);
+    // 空key等价于全0的key
+    std::string unit = m_key.empty() ? std::string(1, '\0') : m_key;
+    size_t keyLen = unit.size();
+    size_t period = keyLen / gcdSize(keyLen, kXorVectorWidth) * kXorVectorWidth;
+    if (period < kXorKeyStreamMinSize) {
+        period *= (kXorKeyStreamMinSize + period - 1) / period;
     }
-    int keyIndex = 0;
-    int keyLen = m_key.size();
-    for (int i = 0; i < byte_length; ++i) {
-        dst[i] ^= m_key[keyIndex];
-        keyIndex = (keyIndex + 1) % keyLen;
+    m_period = period;
+    m_keyStream.resize(period + kXorVectorWidth);
+    for (size_t i = 0; i < m_keyStream.size(); ++i) {
+        m_keyStream[i] = unit[i % keyLen];
     }
 }
 
+void Xor::encrypt(unsigned char* dst, const unsigned char* src, int byte_length) {
+    encryptAt(dst, src, byte_length, 0);
+}
+
 void Xor::decrypt(unsigned char* dst, const unsigned char* src, int byte_length) {
-    if (dst != src) {
-        memcpy(dst, src, byte_length);
+    encryptAt(dst, src, byte_length, 0);
+}
+
+void Xor::encryptAt(unsigned char* dst, const unsigned char* src, int byte_length,
+                    uint64_t offset) {
+    if (byte_length > 0) {
+        apply(dst, src, byte_length, NULL, offset);
     }
-    int keyIndex = 0;
-    int keyLen = m_key.size();
-    for (int i = 0; i < byte_length; ++i) {
-        dst[i] ^= m_key[keyIndex];
-        keyIndex = (keyIndex + 1) % keyLen;
+}
+
+// 密钥流为key与iv按位置循环异或
+void Xor::cryptStream(unsigned char* dst, const unsigned char* src, int byte_length,
+                      const unsigned char* iv, uint64_t offset) {
+    if (byte_length > 0) {
+        apply(dst, src, byte_length, iv, offset);
     }
 }
 
+void Xor::apply(unsigned char* dst, const unsigned char* src, size_t len,
+                const unsigned char* iv, uint64_t offset) {
+    static const XorKernel kernel = selectXorKernel();
+    if (m_period == 0) {
+        // 未设置key时按空key处理
+        setKey((const unsigned char*)"", 0);
+    }
+
+    const unsigned char* stream = (const unsigned char*)m_keyStream.data();
+    size_t phase = (size_t)(offset % m_period);
+    unsigned char ivStream[kXorVectorWidth];
+    size_t done = 0;
+    while (done < len) {
+        // 每段从当前相位读到周期末尾，iv流按本段起始位置对齐
+        size_t n = std::min(len - done, m_period - phase);
+        uint64_t pos = offset + done;
+        for (size_t i = 0; i < kXorVectorWidth; ++i) {
+            ivStream[i] = iv ? iv[(pos + i) % kEncryptIvLen] : 0;
+        }
+        kernel(dst + done, src + done, stream + phase, ivStream, n);
+        done += n;
+        phase = 0;
+    }
+}
 }  // end namespace dailycode
\ No newline at end of file
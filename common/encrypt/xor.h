@@ -16,11 +16,33 @@
 
 namespace dailycode {
 
+#define kXorVectorWidth 64        // 最宽的向量寄存器字节数(AVX-512)
+#define kXorKeyStreamMinSize 4096  // 预计算的密钥流周期不小于该长度
+
 class Xor : public baseEncrypt {
  public:
+    Xor() : m_period(0) {}
+
     virtual void setKey(const unsigned char* key, int byte_length);
     virtual void encrypt(unsigned char* dst, const unsigned char* src, int byte_length);
     virtual void decrypt(unsigned char* dst, const unsigned char* src, int byte_length);
+    virtual void cryptStream(unsigned char* dst, const unsigned char* src, int byte_length,
+                             const unsigned char* iv, uint64_t offset);
+
+    // 与encrypt相同，但key从offset处的相位开始，多次调用可以接续同一个密钥流
+    void encryptAt(unsigned char* dst, const unsigned char* src, int byte_length,
+                   uint64_t offset);
+
+ private:
+    // dst = src ^ key流[offset...] ^ iv流[offset...]，iv为空时只异或key
+    void apply(unsigned char* dst, const unsigned char* src, size_t len, const unsigned char* iv,
+               uint64_t offset);
+
+ private:
+    // key重复展开到m_period字节(key长度和向量宽度的公倍数)，末尾再多展开kXorVectorWidth字节，
+    // 从任意相位开始都能连续读取，不需要逐字节取模
+    std::string m_keyStream;
+    size_t m_period;
 };
 
 }  // end namespace dailycode
\ No newline at end of file
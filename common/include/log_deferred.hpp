@@ -0,0 +1,165 @@
+/***************************************************************************
+*
+* Copyright (c) 2020 jackszhang, All Rights Reserved
+*
+* @file    log_deferred.hpp
+* @author  jackszhang
+* @date    2020/10/25
+* @brief   The interface of deferred log 延迟格式化日志的参数编解码
+*
+**************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <tuple>
+#include <type_traits>
+
+namespace dailycode {
+
+// 延迟格式化模式下：
+// 1. 生产者只记录静态的日志描述(格式串、文件、函数、行号)指针和参数的原始字节
+// 2. 日志线程取出后，通过编译期生成的formatDeferredArgs<Args...>还原参数并格式化
+
+// 写线程格式化函数，返回值同snprintf
+typedef int (*DeferredFormatFunc)(char* buf, size_t len, const char* format, const char* data);
+
+// 每个日志调用点的静态描述，生命周期与程序一致
+struct DeferredLogInfo {
+    int32_t level;
+    const char* levelStr;
+    const char* fileName;
+    const char* function;
+    int32_t line;
+    const char* format;
+};
+
+// 指针指向的字符类型，非字符指针为void
+template <typename T>
+struct DeferredPointee {
+    typedef typename std::remove_cv<typename std::remove_pointer<T>::type>::type type;
+};
+
+// 宽字符串无法按字节拷贝，格式化时调用方的内存可能已失效，编译期拒绝
+template <typename T>
+struct IsDeferredWideStr {
+    static const bool value = std::is_pointer<T>::value &&
+                              (std::is_same<typename DeferredPointee<T>::type, wchar_t>::value ||
+                               std::is_same<typename DeferredPointee<T>::type, char16_t>::value ||
+                               std::is_same<typename DeferredPointee<T>::type, char32_t>::value);
+};
+
+// 定长参数：整数、浮点、枚举、指针，按原始字节保存
+template <typename T>
+struct DeferredArg {
+    static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value ||
+                      std::is_pointer<T>::value,
+                  "deferred log only supports arithmetic, enum, pointer and c-string arguments");
+    static_assert(!IsDeferredWideStr<T>::value,
+                  "deferred log does not support wide strings, convert them to char* first");
+    typedef T Type;
+
+    static size_t size(const T&) { return sizeof(T); }
+
+    static char* encode(char* dst, const T& value) {
+        memcpy(dst, &value, sizeof(T));
+        return dst + sizeof(T);
+    }
+
+    static T decode(const char*& src) {
+        T value;
+        memcpy(&value, src, sizeof(T));
+        src += sizeof(T);
+        return value;
+    }
+};
+
+// C字符串：调用方的内存在格式化时可能已失效，因此拷贝内容(含'\0')。
+// char/unsigned char/signed char指针都按字符串处理
+template <typename CharT>
+struct DeferredStrArg {
+    typedef const CharT* Type;
+
+    static const char* safeStr(const CharT* value) {
+        return value ? (const char*)value : "(null)";
+    }
+
+    static size_t size(const CharT* value) { return strlen(safeStr(value)) + 1; }
+
+    static char* encode(char* dst, const CharT* value) {
+        const char* str = safeStr(value);
+        size_t len = strlen(str) + 1;
+        memcpy(dst, str, len);
+        return dst + len;
+    }
+
+    static const CharT* decode(const char*& src) {
+        const char* value = src;
+        src += strlen(src) + 1;
+        return (const CharT*)value;
+    }
+};
+
+template <>
+struct DeferredArg<const char*> : public DeferredStrArg<char> {};
+template <>
+struct DeferredArg<char*> : public DeferredStrArg<char> {};
+template <>
+struct DeferredArg<const unsigned char*> : public DeferredStrArg<unsigned char> {};
+template <>
+struct DeferredArg<unsigned char*> : public DeferredStrArg<unsigned char> {};
+template <>
+struct DeferredArg<const signed char*> : public DeferredStrArg<signed char> {};
+template <>
+struct DeferredArg<signed char*> : public DeferredStrArg<signed char> {};
+
+// C++11没有std::index_sequence，这里自己实现
+template <size_t... Index>
+struct DeferredIndexSeq {};
+
+template <size_t N, size_t... Index>
+struct MakeDeferredIndexSeq : MakeDeferredIndexSeq<N - 1, N - 1, Index...> {};
+
+template <size_t... Index>
+struct MakeDeferredIndexSeq<0, Index...> {
+    typedef DeferredIndexSeq<Index...> type;
+};
+
+inline size_t deferredArgsSize() { return 0; }
+
+template <typename T, typename... Args>
+inline size_t deferredArgsSize(const T& value, const Args&... args) {
+    return DeferredArg<T>::size(value) + deferredArgsSize(args...);
+}
+
+inline char* encodeDeferredArgs(char* dst) { return dst; }
+
+template <typename T, typename... Args>
+inline char* encodeDeferredArgs(char* dst, const T& value, const Args&... args) {
+    return encodeDeferredArgs(DeferredArg<T>::encode(dst, value), args...);
+}
+
+template <typename Tuple, size_t... Index>
+inline int applyDeferredFormat(char* buf, size_t len, const char* format, const Tuple& values,
+                               DeferredIndexSeq<Index...>) {
+    return snprintf(buf, len, format, std::get<Index>(values)...);
+}
+
+template <typename... Args>
+int formatDeferredArgs(char* buf, size_t len, const char* format, const char* data) {
+    // 花括号初始化保证从左到右依次解码
+    std::tuple<typename DeferredArg<Args>::Type...> values{DeferredArg<Args>::decode(data)...};
+    (void)data;
+    return applyDeferredFormat(buf, len, format, values,
+                               typename MakeDeferredIndexSeq<sizeof...(Args)>::type());
+}
+
+// 仅用于编译期检查格式串和参数是否匹配，不会被调用
+inline void checkLogFormat(const char*, ...) __attribute__((format(printf, 1, 2)));
+inline void checkLogFormat(const char*, ...) {}
+
+}  // end namespace dailycode
@@ -17,25 +17,46 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <time.h>
 
 #include <map>
 #include <set>
 #include <string>
 #include <deque>
+#include <functional>
 #include <mutex>
+#include <condition_variable>
 #include <atomic>
 #include <memory>
 #include <thread>
 #include "encrypt.h"
 
 #include "singleton.hpp"
+#include "utils.h"
+#include "log_ring_buffer.hpp"
+#include "log_deferred.hpp"
+#include "log_stream.hpp"
+#include "log_writer.h"
+#include "log_frame.h"
+#include "zip.h"
+#include "log_sink.h"
 
 namespace dailycode {
 
 // 压缩文件回调，目前仅仅支持zip压缩
 class ZipLogCallBack {
  public:
+    virtual ~ZipLogCallBack() {}
+
+    // zipLogs只在回调期间有效
     virtual void onRecvZipLog(const std::string filePath, const std::string& zipLogs) = 0;
+
+    // 所有回调共享同一份在内存中打包的zip，不再拷贝，可以在回调返回后继续持有；
+    // 默认转给onRecvZipLog。LC_LOG_ZIP_SAVE_FILE为0时filePath处没有文件
+    virtual void onRecvZipData(const std::string& filePath,
+                               const std::shared_ptr<const std::string>& zipData) {
+        onRecvZipLog(filePath, *zipData);
+    }
 };
 
 #define defaultLogLevel LL_LOG_INFO            // 默认Info级别日志
@@ -48,12 +69,29 @@ class ZipLogCallBack {
     0  // 默认不需要加密日志，默认不需要，目前提供xor、blowfish等加密策略
 #define defaultXorEncryptKey "qwertyuiop"       // 默认xor加密算法的key
 #define defaultBlowfishEncryptKey "qwertyuiop"  // 默认blowfish加密算法的key
+#define defaultAesEncryptKey "qwertyuiop"       // 默认aes加密算法的key
 #define defaultLogMaxConcurrentCnt 10000        // 最大并发log数量，默认1000个
 #define defauleLogEnableCompress 0              // 默认允许压缩日志
 #define defauleLogCompressInterval 300          // 默认压缩间隔300s，单位秒
 #define defaultLogOutputPath "./"               // 日志文件输出到当前目录
 #define defaultLogFileName "logsdk"             // 日志文件名字，默认为logsdk.log
 #define defaultAppName "logsdk"                 // 日志APP名称，默认logsdk
+#define defaultLogTimeFormat 0                  // 默认毫秒精度，使用CLOCK_REALTIME
+#define defaultLogFlushBytes 64 * 1024          // 默认批量写缓冲区攒够64K写一次文件
+#define defaultLogFlushInterval 100             // 默认最多100ms写一次文件，单位毫秒
+#define defaultLogFlushOnError 1                // 默认遇到ERROR日志立即写文件
+#define defaultLogOverflowPolicy LOP_DROP_NEWEST  // 默认队列满时丢弃新日志
+#define defaultLogBlockTimeout 100              // 默认阻塞等待队列空间100ms，单位毫秒
+#define defaultLogMaxQueueBytes 32 * 1024 * 1024  // 默认队列中日志最多占用32M，0表示不限制
+#define defaultLogShedWatermark 80              // 默认队列使用超过80%时丢弃TRACE/INFO日志
+#define defaultLogWriterMode LWM_SYNC           // 默认日志线程同步写文件
+#define defaultLogDirectIo 0                    // 默认不使用O_DIRECT
+#define defaultLogWatchDir 0                    // 默认不监听日志目录的外部修改
+#define defaultLogCompressOnRotate 0            // 默认滚动后不单独压缩日志文件
+#define defaultLogFilesMaxBytes 0               // 默认只按文件数量清理，不限制总大小
+#define defaultLogZipSaveFile 1                 // 默认打包的zip同时写到日志目录
+#define defaultLogZipThreads 1                  // 默认在打包线程内单线程压缩
+#define defaultLogConsoleMaxPending 100000      // 默认终端最多积压10万条日志
 
 enum LogConfigInt {
     LC_LOG_LEVEL = 0,           // 日志级别，默认Info
@@ -66,12 +104,30 @@ enum LogConfigInt {
     LC_LOG_MAX_CONCURRENT_CNT,  // 最大并发log数量，默认1000个
     LC_LOG_ENABLE_COMPRESS,     // 是否允许压缩日志
     LC_LOG_COMPRESS_INTERVAL,   // 压缩日志间隔
+    LC_LOG_TIME_FORMAT,         // 日志时间格式，TimeFormatFlag按位组合(微秒精度、粗粒度时钟)
+    LC_LOG_FLUSH_BYTES,         // 批量写缓冲区达到该字节数时写文件
+    LC_LOG_FLUSH_INTERVAL,      // 批量写的最大间隔，单位毫秒
+    LC_LOG_FLUSH_ON_ERROR,      // 遇到ERROR级别日志时是否立即写文件
+    LC_LOG_OVERFLOW_POLICY,     // 队列满时的处理策略，见LogOverflowPolicy
+    LC_LOG_BLOCK_TIMEOUT,       // LOP_BLOCK/LOP_DROP_OLDEST等待队列空间的超时，单位毫秒
+    LC_LOG_MAX_QUEUE_BYTES,     // 队列中日志占用的最大字节数，0表示只按条数限制
+    LC_LOG_SHED_WATERMARK,      // LOP_DROP_BY_LEVEL开始丢弃TRACE/INFO的队列使用百分比
+    LC_LOG_WRITER_MODE,         // 日志文件写入方式，见LogWriterMode，下次写文件时生效
+    LC_LOG_DIRECT_IO,           // 异步写时是否使用O_DIRECT绕过page cache
+    LC_LOG_WATCH_DIR,           // 是否用inotify同步外部进程对日志目录的修改
+    LC_LOG_COMPRESS_ON_ROTATE,  // 滚动后是否在后台把文件压缩为同名的.log.zip
+    LC_LOG_FILES_MAX_BYTES,     // 已滚动文件(压缩后按压缩文件计)的最大总字节数，0表示不限制
+    LC_LOG_ZIP_SAVE_FILE,       // 打包的zip是否写到日志目录的<app>.zip，回调总是收到内存中的数据
+    LC_LOG_ZIP_THREADS,         // 压缩1M以上的文件时使用的线程数，0表示按CPU核数
+    LC_LOG_CONSOLE_PENDING,     // 终端最多积压的日志条数，超过后丢弃并计数
+    LC_LOG_CONF_INT_CNT,        // 整型配置的数量，新增配置需加在此之前
 };
 
 enum LogConfigStr {
     LC_LOG_OUTPUT_PATH = 0,  // 日志输出路径，建议使用绝对路径
     LC_LOG_FILE_NAME,        // 日志文件名字
     LC_LOG_APP_NAME,         // 日志app名称，会输出到每行日志，便于日志染色
+    LC_LOG_CONF_STR_CNT,     // 字符串配置的数量，新增配置需加在此之前
 };
 
 enum LogLevel {
@@ -86,6 +142,39 @@ enum EncryptionType {
     ET_NO_ENCRYPTION,
     ET_XOR_ENCRYPTION,
     ET_BLOWFISH_ENCRYPTION,
+    ET_AES_ENCRYPTION,
+};
+
+// 日志队列中的一条记录，槽位复用以避免反复申请内存
+// deferredFormat非空时为延迟格式化的记录，data中保存的是参数的原始字节
+struct LogRecord {
+    int32_t level;
+    std::string data;
+    const DeferredLogInfo* deferredInfo;
+    DeferredFormatFunc deferredFormat;
+    struct timespec stamp;
+};
+
+// 不可变的配置快照，修改配置时整体替换为新版本，读者无需加锁
+struct LogConfig {
+    int32_t intConf[LC_LOG_CONF_INT_CNT];
+    std::string strConf[LC_LOG_CONF_STR_CNT];
+    std::string logPrefix;  // " appName [pid:this] "，由LC_LOG_APP_NAME生成
+};
+
+// 日志线程的运行统计，用于评估写线程的负载
+struct LogWriterStats {
+    uint64_t busyUs;   // 处理日志、写文件、压缩等耗时，单位微秒
+    uint64_t idleUs;   // 等待新日志的休眠耗时，单位微秒
+    uint64_t wakeups;  // 被生产者唤醒的次数
+};
+
+// 日志队列满(条数或者字节数)时的处理策略
+enum LogOverflowPolicy {
+    LOP_DROP_NEWEST = 0,  // 丢弃当前这条日志
+    LOP_DROP_OLDEST,      // 通知日志线程丢弃最早的日志腾出空间，超时后丢弃当前日志
+    LOP_BLOCK,            // 阻塞等待队列空间，超时后丢弃当前日志
+    LOP_DROP_BY_LEVEL,    // 队列使用超过水位后丢弃TRACE/INFO，WARN/ERROR直到队列满才丢弃
 };
 
 class LogFile : public SingleTon<LogFile> {
@@ -108,51 +197,274 @@ class LogFile : public SingleTon<LogFile> {
     // 发起压缩文件请求
     void addZipRequest(std::shared_ptr<ZipLogCallBack> callBack);
 
+    // 日志线程的忙闲统计
+    LogWriterStats getWriterStats();
+
+    // 添加文件之外的输出目标，返回id供removeSink使用，失败返回-1；
+    // levelMask由LOG_SINK_LEVEL按级别组合，maxPending为该目标最多积压的日志条数
+    int32_t addSink(std::shared_ptr<LogSink> sink, uint32_t levelMask = kLogSinkAllLevels,
+                    size_t maxPending = defaultLogSinkMaxPending);
+    void removeSink(int32_t sinkId);
+
+    // 运行时级别过滤，供LOG*/SLOG*宏在求值参数前内联判断，只有一次relaxed load
+    static bool isLevelEnabled(int32_t level) {
+        return level >= m_logLevel.load(std::memory_order_relaxed);
+    }
+
     // 写日志
     void recviveOneLog(LogLevel level, const char* levelStr, const char* fileName,
                        const char* format, ...);
 
+    // 延迟格式化写日志，只拷贝参数的原始字节，格式化在日志线程完成
+    template <typename... Args>
+    void recviveDeferredLog(const DeferredLogInfo* info, Args... args);
+
+    // 流式日志，正文已经格式化完成，只拼接日志头后直接入队
+    void recviveStreamLog(LogLevel level, const char* levelStr, const char* fileName,
+                          const char* function, int32_t line, const char* msg, size_t msgLen);
+
  private:
-    bool writeOneLog(const std::string& log);
+    void appendOneLog(int32_t level, const std::string& log);
+    bool flushLogs();
+    void sealBatch();
     void threadFunc();
-    void updateLogFiles();
-    void cleanOldFiles();
+    // 取出并处理一批日志，返回取出的条数
+    size_t drainLogs();
+    void waitForLogs();
+    void notifyWriter();
+    void submitSinks();
+    // 按配置创建、重建或停止终端输出目标
+    void updateConsoleSink();
+
+    // 入队，按LC_LOG_OVERFLOW_POLICY处理队列满的情况
+    template <class F>
+    bool pushLog(int32_t level, size_t bytes, F fill);
+    bool reserveQueueBytes(int32_t level, size_t bytes);
+    bool waitForSpace(uint32_t startStamp);
+    void notifyProducers();
+    void appendDroppedSummary();
+    bool canRecviveLog(int32_t level);
+    size_t formatLogHead(char* buf, size_t cap, const LogConfig& conf, const char* levelStr,
+                         const char* fileName);
+    void formatDeferredLog(const LogRecord& record, std::string& out);
+    void updateLogFiles(const LogConfig& conf);
+    void rebuildLogFiles(const LogConfig& conf, const std::string& logDir);
+    void syncLogFiles(const LogConfig& conf);
+    void closeDirWatch();
+    void cleanOldFiles(const LogConfig& conf);
     bool enableCompress();
     void compressLogs();
-    void onCompressData(std::string compressLogPath);
+    struct ZipSnapshot;
+    void buildZip(const std::shared_ptr<const LogConfig>& conf,
+                  const std::shared_ptr<ZipSnapshot>& snapshot);
+    void clearZipCache();
+    void onCompressData(const std::string& compressLogPath);
+    void saveZipFile(const std::string& compressLogPath, const std::string& zipData);
+
+    // 当前线程缓存的配置快照，仅在配置版本变化时重新加载，未初始化时为空
+    const std::shared_ptr<const LogConfig>& currentConf();
+    std::shared_ptr<LogConfig> copyConf();
+    void publishConf(const std::shared_ptr<LogConfig>& conf);
+    std::string buildLogPrefix(const std::string& appName);
 
  private:
     bool openFile();
+    bool attachFile(int fd, const std::string& logFile);
+    void closeFile();
+    void rotateFile();
+
+    // 维护线程：滚动改名、文件索引、过期文件清理以及预先创建下一个日志文件，
+    // 日志线程自身不做目录操作，滚动时直接切换到预先创建的文件
+    void houseKeepFunc();
+    void postHouseTask(const std::function<void()>& task);
+    std::string getSparePath(const LogConfig& conf);
+    // 压缩线程：以最低优先级把滚动后的文件压缩为单文件zip，完成后交给维护线程更新索引；
+    // 打包请求的zip也在这里生成
+    void packFunc();
+    bool postPackTask(const std::function<void()>& task, bool urgent = false);
+    void postPackTask(const std::shared_ptr<const LogConfig>& conf, uint32_t stamp,
+                      const std::string& stampFile);
+    void packRotatedFile(const std::shared_ptr<const LogConfig>& conf, uint32_t stamp,
+                         const std::string& stampFile);
+    void prepareSpareFile(const std::shared_ptr<const LogConfig>& conf);
+    // 取走预创建的文件，在改名为logFile之前登记为日志线程正在写的文件
+    int takeSpareFile(const std::string& sparePath);
+    void setLiveSpare(const std::string& sparePath, bool live);
+    void closeSpareFile();
 
  private:
     friend class SingleTon<LogFile>;
     LogFile(void) {};
     ~LogFile() {};
 
+    // 生产者在整个入队过程中计数，DeInit清除m_isInit后等计数归零才释放队列和配置。
+    // 清除后到达的生产者不计数，持续写日志时计数也能归零
+    class ProducerScope {
+     public:
+        ProducerScope() : m_entered(m_isInit.load()) {
+            if (m_entered) {
+                m_activeProducers.fetch_add(1);
+            }
+        }
+        ~ProducerScope() {
+            if (m_entered) {
+                m_activeProducers.fetch_sub(1);
+            }
+        }
+        bool entered() const { return m_entered; }
+
+     private:
+        bool m_entered;
+    };
+
  private:
-    static bool m_isInit;
-    char* m_logBuffer;
-    std::mutex m_logMutex;
-    std::map<int32_t, int32_t> m_logConfIntMap;
-    std::map<int32_t, std::string> m_logConfStrMap;
+    static std::atomic<bool> m_isInit;
+    static std::atomic<int32_t> m_activeProducers;
+    std::mutex m_logMutex;  // 串行化配置修改和加密工具的访问，不在日志热路径上
+    static std::atomic<int32_t> m_logLevel;  // LL_LOG_NONE大于所有级别，即全部关闭
+    static std::atomic<uint64_t> m_logConfVersion;
+    std::shared_ptr<const LogConfig> m_logConf;      // 通过std::atomic_load/atomic_store发布
+    std::shared_ptr<const LogConfig> m_writerConf;  // 日志线程每轮开始时持有的快照
     std::map<int32_t, std::shared_ptr<baseEncrypt>> m_encryptTools;
 
+    // 输出目标列表，修改时整体替换，日志线程每轮开始时取一次快照
+    typedef std::vector<std::shared_ptr<LogSinkChannel>> LogSinkList;
+    std::shared_ptr<const LogSinkList> m_sinks;  // 通过std::atomic_load/atomic_store发布
+    std::shared_ptr<const LogSinkList> m_writerSinks;
+    std::shared_ptr<LogSinkChannel> m_consoleSink;  // LC_LOG_NEED_PRINT_CONSOLE，日志线程按配置创建
+    int32_t m_nextSinkId;
+
  private:
     std::shared_ptr<std::thread> m_logThread;
     std::atomic<bool> m_stopThreadFlag;
-    std::deque<std::string> m_allLogs;
+    // 队列为空时日志线程休眠，生产者只在队列由空变为非空时唤醒
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wakeCond;
+    std::atomic<bool> m_writerSleeping;
+    std::atomic<uint64_t> m_writerBusyUs;
+    std::atomic<uint64_t> m_writerIdleUs;
+    std::atomic<uint64_t> m_writerWakeups;
+    // 队列满时的背压处理
+    std::mutex m_spaceMutex;
+    std::condition_variable m_spaceCond;
+    std::atomic<uint32_t> m_spaceWaiters;   // 等待队列空间的生产者数量
+    std::atomic<uint32_t> m_evictRequests;  // 请求日志线程丢弃的最早日志条数
+    std::atomic<int64_t> m_queueBytes;      // 队列中日志占用的字节数
+    std::atomic<uint64_t> m_droppedLogs;    // 尚未汇报的丢弃日志条数
+    std::shared_ptr<MpscRingBuffer<LogRecord>> m_allLogs;
+    std::string m_deferredBuffer;  // 日志线程格式化延迟日志使用
 
  private:
-    FILE* m_logFd;
+    int m_logFd;
+    std::shared_ptr<LogWriter> m_writer;  // 与m_logFd一起打开/关闭
+    int32_t m_writerMode;
+    int32_t m_writerDirectIo;
+    uint64_t m_curFileSize;       // 当前日志文件大小，在内存中维护
+    uint32_t m_freshFileSeq;      // 滚动时没有预创建的文件，日志线程直接创建的文件序号
+    uint32_t m_lastRotateStamp;   // 上次滚动使用的时间戳
+    std::string m_writeBuffer;    // 批量写缓冲区，一批日志一次write
+    int32_t m_batchEncType;       // 当前批次的加密方式，加密时m_writeBuffer为一帧
+    uint32_t m_batchRecordCnt;
+    uint64_t m_batchSeq;          // 加密批次序号，与m_ivSeed组成每批的IV
+    uint64_t m_ivSeed;
+    bool m_needFlush;             // 遇到需要立即落盘的日志
+    uint32_t m_lastFlushStamp;
+    // 维护线程及其任务队列，m_houseMutex同时保护预创建的文件
+    std::shared_ptr<std::thread> m_houseThread;
+    std::mutex m_houseMutex;
+    std::condition_variable m_houseCond;
+    std::deque<std::function<void()>> m_houseTasks;
+    bool m_houseBusy;
+    bool m_houseStop;
+    int m_spareFd;
+    std::string m_sparePath;
+    std::set<std::string> m_liveSpares;  // 日志线程已经在写、还没改名为logFile的预创建文件
+    // 压缩线程及其任务队列
+    std::shared_ptr<std::thread> m_packThread;
+    std::mutex m_packMutex;
+    std::condition_variable m_packCond;
+    std::deque<std::function<void()>> m_packTasks;
+    bool m_packStop;
+
+    // 已滚动日志文件的索引(时间戳 --> 文件名)，只在目录或文件名变化时扫描一次目录，
+    // 之后随滚动和清理增量更新，只在维护线程中修改
     std::map<uint32_t, std::string> m_allFiles;
+    std::string m_indexedLogDir;  // m_allFiles对应的目录和日志文件名
+    int m_dirWatchFd;             // 监听日志目录的inotify句柄
 
+    // m_zipMutex保护回调列表、m_zipPending和上次打包的结果
     std::mutex m_zipMutex;
+    bool m_zipPending;  // 已交给压缩线程、尚未回调的打包
     uint32_t m_lastCompressStamp;
+    // 打包时的文件列表和当前日志文件，日志线程和维护线程填好后交给压缩线程
+    struct ZipSnapshot {
+        ZipSnapshot() : nowFd(-1), nowSize(0) {}
+        ~ZipSnapshot();
+
+        std::string compressName;                 // <app>.zip
+        std::string nowFileName;                  // 当前日志文件在zip中的名字
+        int nowFd;                                // 当前日志文件的只读句柄，滚动改名后仍然有效
+        uint64_t nowSize;                         // 快照时当前日志文件中已写完的大小
+        std::map<uint32_t, std::string> allFiles;  // 维护线程完成之前的改名和清理后的索引
+    };
+    // 上次打包的zip及其中已滚动文件的压缩数据位置，文件名、大小和修改时间都没变时
+    // 下次打包直接拷贝压缩数据，不再重新压缩，m_zipCache只在压缩线程中使用
+    struct ZipCacheEntry {
+        uint64_t size;
+        int64_t mtimeNs;
+        ZIPRAW raw;
+    };
+    std::shared_ptr<const std::string> m_zipData;     // 间隔内的请求直接复用
+    std::map<std::string, ZipCacheEntry> m_zipCache;  // 日志文件名 --> m_zipData中的压缩数据
+    std::string m_zipCachePath;                       // m_zipData对应的<app>.zip
     std::set<std::weak_ptr<ZipLogCallBack>, std::owner_less<std::weak_ptr<ZipLogCallBack>>>
         m_zipCallBacks;
 };
 
-// 流失输出日志辅助类
+template <typename... Args>
+void LogFile::recviveDeferredLog(const DeferredLogInfo* info, Args... args) {
+    ProducerScope scope;
+    if (!canRecviveLog(info->level) || !scope.entered()) {
+        return;
+    }
+    const std::shared_ptr<const LogConfig>& conf = currentConf();
+    if (!conf) {
+        return;
+    }
+    struct timespec stamp;
+    Utils::getRealTime(stamp, conf->intConf[LC_LOG_TIME_FORMAT]);
+    size_t argsSize = deferredArgsSize(args...);
+    pushLog(info->level, argsSize, [&](LogRecord& record) {
+        record.level = info->level;
+        record.deferredInfo = info;
+        record.deferredFormat = &formatDeferredArgs<Args...>;
+        record.stamp = stamp;
+        record.data.resize(argsSize);
+        encodeDeferredArgs(&record.data[0], args...);
+    });
+}
+
+template <class F>
+bool LogFile::pushLog(int32_t level, size_t bytes, F fill) {
+    if (!reserveQueueBytes(level, bytes)) {
+        return false;
+    }
+    uint32_t startStamp = Utils::getTickCount();
+    bool wasEmpty = false;
+    while (!m_allLogs->push(fill, &wasEmpty)) {
+        if (!waitForSpace(startStamp)) {
+            m_queueBytes.fetch_sub(bytes, std::memory_order_relaxed);
+            m_droppedLogs.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+    if (wasEmpty) {
+        notifyWriter();
+    }
+    return true;
+}
+
+// 流失输出日志辅助类，正文写入栈上的LogStream，析构时直接入队，不再经过printf格式化
 class StreamLogHelper {
  public:
     StreamLogHelper(LogLevel level, const char* levelStr, const char* codeFileName,
@@ -165,15 +477,23 @@ class StreamLogHelper {
 
     template <typename T>
     StreamLogHelper& operator<<(const T& t) {
-        ss << t;
+        m_stream << t;
+        return *this;
+    }
+    // 操纵符单独重载，std::endl等函数模板才能推导出类型
+    StreamLogHelper& operator<<(std::ios_base& (*manip)(std::ios_base&)) {
+        m_stream << manip;
+        return *this;
+    }
+    StreamLogHelper& operator<<(std::ostream& (*manip)(std::ostream&)) {
+        m_stream << manip;
         return *this;
     }
 
     ~StreamLogHelper() {
-        SingleTon<LogFile>::Instance()->recviveOneLog(m_level, m_levelStr, m_codeFileName,
-                                                      "-%s:%d] %s", m_codeFunction, m_codeLine,
-                                                      ss.str().c_str());
-        ss.clear();
+        SingleTon<LogFile>::Instance()->recviveStreamLog(m_level, m_levelStr, m_codeFileName,
+                                                         m_codeFunction, m_codeLine,
+                                                         m_stream.data(), m_stream.size());
     }
 
  private:
@@ -182,7 +502,13 @@ class StreamLogHelper {
     const char* m_codeFileName;
     const char* m_codeFunction;
     const int32_t m_codeLine;
-    std::stringstream ss;
+    LogStream m_stream;
+};
+
+// 让SLOG*宏整体成为void表达式，&的优先级低于<<，保证所有operator<<先结合
+class StreamLogVoidify {
+ public:
+    void operator&(const StreamLogHelper&) {}
 };
 
 }  // end namespace dailycode
@@ -198,30 +524,103 @@ class StreamLogHelper {
 // 压缩日志请求
 #define LOG_ZIP_REQUEST(callback) SingleTon<LogFile>::Instance()->addZipRequest(callback)
 
+// 输出目标
+#define LOG_ADD_SINK(sink, levelMask) SingleTon<LogFile>::Instance()->addSink(sink, levelMask)
+#define LOG_REMOVE_SINK(sinkId) SingleTon<LogFile>::Instance()->removeSink(sinkId)
+
 /*************  LOG API  *************/
+// 编译期最低日志级别，取值同LogLevel(0-TRACE 1-INFO 2-WARN 3-ERROR 4-NONE)，
+// 低于该级别的LOG*/SLOG*展开为死代码，参数不会求值，字符串常量也会被编译器丢弃，
+// 可通过cmake -DLOG_MIN_LEVEL=1设置
+#ifndef DAILYCODE_LOG_MIN_LEVEL
+#define DAILYCODE_LOG_MIN_LEVEL 0
+#endif
+
+// 被编译期裁剪的日志，仍然保留格式串检查，避免参数出现未使用的告警
+#define LOG_DISABLED(format, args...)        \
+    do {                                     \
+        if (false) {                         \
+            checkLogFormat(format, ##args);  \
+        }                                    \
+    } while (0)
+
 // C风格日志输出
-#define LOGT(format, args...)                                                                \
-    SingleTon<LogFile>::Instance()->recviveOneLog(LogLevel::LL_LOG_TRACE, "T", __FILE__,     \
-                                                  "-%s:%d] " format, __FUNCTION__, __LINE__, \
-                                                  ##args)
-#define LOGI(format, args...)                                                                \
-    SingleTon<LogFile>::Instance()->recviveOneLog(LogLevel::LL_LOG_INFO, "I", __FILE__,      \
-                                                  "-%s:%d] " format, __FUNCTION__, __LINE__, \
-                                                  ##args)
-#define LOGW(format, args...)                                                                \
-    SingleTon<LogFile>::Instance()->recviveOneLog(LogLevel::LL_LOG_WARN, "W", __FILE__,      \
-                                                  "-%s:%d] " format, __FUNCTION__, __LINE__, \
-                                                  ##args)
-#define LOGE(format, args...)                                                                \
-    SingleTon<LogFile>::Instance()->recviveOneLog(LogLevel::LL_LOG_ERROR, "E", __FILE__,     \
-                                                  "-%s:%d] " format, __FUNCTION__, __LINE__, \
-                                                  ##args)
+// 定义DAILYCODE_LOG_DEFERRED(cmake -DENABLE_DEFERRED_LOG=ON)后，使用延迟格式化模式，
+// 此时format必须是字符串常量，参数仅支持整数、浮点、枚举、指针和C字符串
+#ifdef DAILYCODE_LOG_DEFERRED
+#define LOG_IMPL(LOGLEVEL, LEVEL_STR, format, args...)                                        \
+    do {                                                                                     \
+        static const DeferredLogInfo dcDeferredLogInfo = {LOGLEVEL,     LEVEL_STR, __FILE__, \
+                                                          __FUNCTION__, __LINE__,  "" format}; \
+        if (false) {                                                                         \
+            checkLogFormat(format, ##args);                                                  \
+        }                                                                                    \
+        if (LogFile::isLevelEnabled(LOGLEVEL)) {                                             \
+            SingleTon<LogFile>::Instance()->recviveDeferredLog(&dcDeferredLogInfo, ##args);  \
+        }                                                                                    \
+    } while (0)
+#else
+#define LOG_IMPL(LOGLEVEL, LEVEL_STR, format, args...)                                           \
+    (!LogFile::isLevelEnabled(LOGLEVEL))                                                        \
+        ? (void)0                                                                               \
+        : SingleTon<LogFile>::Instance()->recviveOneLog(LOGLEVEL, LEVEL_STR, __FILE__,          \
+                                                        "-%s:%d] " format, __FUNCTION__,        \
+                                                        __LINE__, ##args)
+#endif
+
+#if DAILYCODE_LOG_MIN_LEVEL <= 0
+#define LOGT(format, args...) LOG_IMPL(LogLevel::LL_LOG_TRACE, "T", format, ##args)
+#else
+#define LOGT(format, args...) LOG_DISABLED(format, ##args)
+#endif
+#if DAILYCODE_LOG_MIN_LEVEL <= 1
+#define LOGI(format, args...) LOG_IMPL(LogLevel::LL_LOG_INFO, "I", format, ##args)
+#else
+#define LOGI(format, args...) LOG_DISABLED(format, ##args)
+#endif
+#if DAILYCODE_LOG_MIN_LEVEL <= 2
+#define LOGW(format, args...) LOG_IMPL(LogLevel::LL_LOG_WARN, "W", format, ##args)
+#else
+#define LOGW(format, args...) LOG_DISABLED(format, ##args)
+#endif
+#if DAILYCODE_LOG_MIN_LEVEL <= 3
+#define LOGE(format, args...) LOG_IMPL(LogLevel::LL_LOG_ERROR, "E", format, ##args)
+#else
+#define LOGE(format, args...) LOG_DISABLED(format, ##args)
+#endif
 
 // 日志流方式输出接口
 #define STREAM_LOG_HELPER(LOGLEVEL, LEVEL_STR, FILE, FUNCTION, LINE) \
     StreamLogHelper(LOGLEVEL, LEVEL_STR, FILE, FUNCTION, LINE)
 
-#define SLOGT() STREAM_LOG_HELPER(LogLevel::LL_LOG_TRACE, "T", __FILE__, __FUNCTION__, __LINE__)
-#define SLOGI() STREAM_LOG_HELPER(LogLevel::LL_LOG_INFO, "I", __FILE__, __FUNCTION__, __LINE__)
-#define SLOGW() STREAM_LOG_HELPER(LogLevel::LL_LOG_WARN, "W", __FILE__, __FUNCTION__, __LINE__)
-#define SLOGE() STREAM_LOG_HELPER(LogLevel::LL_LOG_ERROR, "E", __FILE__, __FUNCTION__, __LINE__)
+// 级别被关闭时不会构造StreamLogHelper，后续的operator<<也不会执行
+#define STREAM_LOG_IMPL(LOGLEVEL, LEVEL_STR)                                   \
+    (!LogFile::isLevelEnabled(LOGLEVEL))                                      \
+        ? (void)0                                                             \
+        : StreamLogVoidify() &                                                \
+              STREAM_LOG_HELPER(LOGLEVEL, LEVEL_STR, __FILE__, __FUNCTION__, __LINE__)
+
+// 被编译期裁剪的流式日志，while(false)保证后续的operator<<不会被执行
+#define STREAM_LOG_DISABLED(LOGLEVEL, LEVEL_STR) \
+    while (false) STREAM_LOG_HELPER(LOGLEVEL, LEVEL_STR, __FILE__, __FUNCTION__, __LINE__)
+
+#if DAILYCODE_LOG_MIN_LEVEL <= 0
+#define SLOGT() STREAM_LOG_IMPL(LogLevel::LL_LOG_TRACE, "T")
+#else
+#define SLOGT() STREAM_LOG_DISABLED(LogLevel::LL_LOG_TRACE, "T")
+#endif
+#if DAILYCODE_LOG_MIN_LEVEL <= 1
+#define SLOGI() STREAM_LOG_IMPL(LogLevel::LL_LOG_INFO, "I")
+#else
+#define SLOGI() STREAM_LOG_DISABLED(LogLevel::LL_LOG_INFO, "I")
+#endif
+#if DAILYCODE_LOG_MIN_LEVEL <= 2
+#define SLOGW() STREAM_LOG_IMPL(LogLevel::LL_LOG_WARN, "W")
+#else
+#define SLOGW() STREAM_LOG_DISABLED(LogLevel::LL_LOG_WARN, "W")
+#endif
+#if DAILYCODE_LOG_MIN_LEVEL <= 3
+#define SLOGE() STREAM_LOG_IMPL(LogLevel::LL_LOG_ERROR, "E")
+#else
+#define SLOGE() STREAM_LOG_DISABLED(LogLevel::LL_LOG_ERROR, "E")
+#endif
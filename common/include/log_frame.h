@@ -0,0 +1,89 @@
+/***************************************************************************
+*
+* Copyright (c) 2020 jackszhang, All Rights Reserved
+*
+* @file    log_frame.h
+* @author  jackszhang
+* @date    2020/11/08
+* @brief   The interface of log frame 加密日志的批次帧格式
+*
+**************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "encrypt.h"
+
+namespace dailycode {
+
+// 开启加密后，每次写文件的一批日志组成一帧，帧头明文，帧体整体按流方式加密：
+//
+//   帧头(32字节，整数均为小端)
+//     magic[4]      "DCLB"，解析出错时可以据此重新定位到下一帧
+//     version[1]    帧格式版本
+//     encType[1]    加密方式，见EncryptType
+//     reserved[2]
+//     payloadLen[4] 帧体字节数
+//     recordCnt[4]  帧体中的日志条数
+//     iv[16]        本批次的IV，每批不同
+//   帧体
+//     recordCnt条日志，每条为4字节小端长度 + 日志内容(不含换行)
+//
+// 帧体用baseEncrypt::cryptStream以iv加密，偏移从0开始，由于流加密可以从任意偏移解密，
+// 每条日志都可以在算出偏移后单独解密
+#define kLogFrameMagic "DCLB"
+#define kLogFrameMagicLen 4
+#define kLogFrameVersion 1
+#define kLogFrameHeaderLen 32
+#define kLogFrameLenSize 4  // 每条日志的长度前缀
+
+struct LogFrameHeader {
+    uint8_t version;
+    uint8_t encType;
+    uint32_t payloadLen;
+    uint32_t recordCnt;
+    unsigned char iv[kEncryptIvLen];
+};
+
+inline void putLogFrameU32(char* dst, uint32_t value) {
+    dst[0] = (char)(value & 0xff);
+    dst[1] = (char)((value >> 8) & 0xff);
+    dst[2] = (char)((value >> 16) & 0xff);
+    dst[3] = (char)((value >> 24) & 0xff);
+}
+
+inline uint32_t getLogFrameU32(const char* src) {
+    const unsigned char* ptr = (const unsigned char*)src;
+    return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) |
+           ((uint32_t)ptr[3] << 24);
+}
+
+// 写入帧头，dst至少kLogFrameHeaderLen字节
+inline void encodeLogFrameHeader(char* dst, const LogFrameHeader& header) {
+    memcpy(dst, kLogFrameMagic, kLogFrameMagicLen);
+    dst[4] = (char)header.version;
+    dst[5] = (char)header.encType;
+    dst[6] = 0;
+    dst[7] = 0;
+    putLogFrameU32(dst + 8, header.payloadLen);
+    putLogFrameU32(dst + 12, header.recordCnt);
+    memcpy(dst + 16, header.iv, kEncryptIvLen);
+}
+
+// 解析帧头，magic或版本不匹配时返回false
+inline bool decodeLogFrameHeader(const char* src, size_t len, LogFrameHeader& header) {
+    if (len < kLogFrameHeaderLen || 0 != memcmp(src, kLogFrameMagic, kLogFrameMagicLen)) {
+        return false;
+    }
+    header.version = (uint8_t)src[4];
+    header.encType = (uint8_t)src[5];
+    header.payloadLen = getLogFrameU32(src + 8);
+    header.recordCnt = getLogFrameU32(src + 12);
+    memcpy(header.iv, src + 16, kEncryptIvLen);
+    return header.version == kLogFrameVersion;
+}
+
+}  // end namespace dailycode
@@ -0,0 +1,129 @@
+/***************************************************************************
+*
+* Copyright (c) 2020 jackszhang, All Rights Reserved
+*
+* @file    log_ring_buffer.hpp
+* @author  jackszhang
+* @date    2020/10/25
+* @brief   The interface of lock-free mpsc ring buffer 多生产者单消费者无锁环形队列
+*
+**************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <thread>
+
+namespace dailycode {
+
+#define kCacheLineSize 64
+
+// 有界无锁MPSC环形队列：
+// 1. 槽位在构造时一次性分配，生产者通过fetch_add申请槽位，写入后发布序号
+// 2. 单个消费者(日志线程)按序号批量取出，取出后归还槽位
+// 3. m_used记录已申请未归还的槽位数，用来在不加锁的情况下做容量限制
+template <class T>
+class MpscRingBuffer {
+ public:
+    explicit MpscRingBuffer(uint32_t capacity) : m_tail(0), m_head(0), m_used(0) {
+        uint32_t slotCnt = 2;
+        while (slotCnt < capacity) {
+            slotCnt <<= 1;
+        }
+        m_mask = slotCnt - 1;
+        m_slots = new Slot[slotCnt];
+        for (uint32_t i = 0; i < slotCnt; ++i) {
+            m_slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+        m_limit.store(capacity > 0 ? capacity : 1, std::memory_order_relaxed);
+    }
+
+    ~MpscRingBuffer() { delete[] m_slots; }
+
+    // 槽位总数，容量上限不能超过该值
+    uint32_t slotCount() const { return (uint32_t)(m_mask + 1); }
+
+    // 调整容量上限，返回实际生效的上限
+    uint32_t setLimit(uint32_t limit) {
+        if (limit == 0) {
+            limit = 1;
+        }
+        if (limit > slotCount()) {
+            limit = slotCount();
+        }
+        m_limit.store(limit, std::memory_order_relaxed);
+        return limit;
+    }
+
+    uint32_t limit() const { return m_limit.load(std::memory_order_relaxed); }
+
+    // 当前未被消费的元素个数(近似值)
+    uint32_t size() const { return m_used.load(); }
+
+    // 生产者接口，fill(T&)负责填充槽位，队列满时返回false
+    // wasEmpty返回入队前队列是否为空，用于只在空->非空时唤醒消费者
+    template <class F>
+    bool push(F fill, bool* wasEmpty = nullptr) {
+        // seq_cst，与消费者休眠前对size()的检查配对，避免丢失唤醒
+        uint32_t used = m_used.fetch_add(1);
+        if (used >= m_limit.load(std::memory_order_relaxed)) {
+            m_used.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (wasEmpty) {
+            *wasEmpty = (used == 0);
+        }
+        uint64_t pos = m_tail.fetch_add(1, std::memory_order_relaxed);
+        Slot& slot = m_slots[pos & m_mask];
+        // m_used保证了该槽位已被归还，这里仅防御极端的内存可见性延迟
+        while (slot.seq.load(std::memory_order_acquire) != pos) {
+            std::this_thread::yield();
+        }
+        fill(slot.value);
+        slot.seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 消费者接口，仅允许单线程调用，最多取出maxCnt个已发布的元素，返回实际个数
+    template <class F>
+    size_t consume(F func, size_t maxCnt) {
+        size_t cnt = 0;
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        while (cnt < maxCnt) {
+            Slot& slot = m_slots[head & m_mask];
+            if (slot.seq.load(std::memory_order_acquire) != head + 1) {
+                // 队列为空，或者生产者已申请槽位但尚未写完
+                break;
+            }
+            func(slot.value);
+            slot.seq.store(head + m_mask + 1, std::memory_order_release);
+            ++head;
+            ++cnt;
+            m_head.store(head, std::memory_order_relaxed);
+            m_used.fetch_sub(1, std::memory_order_release);
+        }
+        return cnt;
+    }
+
+ private:
+    MpscRingBuffer(const MpscRingBuffer&);
+    MpscRingBuffer& operator=(const MpscRingBuffer&);
+
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        T value;
+    };
+
+ private:
+    alignas(kCacheLineSize) std::atomic<uint64_t> m_tail;  // 生产者竞争
+    alignas(kCacheLineSize) std::atomic<uint64_t> m_head;  // 消费者独占
+    alignas(kCacheLineSize) std::atomic<uint32_t> m_used;  // 已申请未归还的槽位数
+    alignas(kCacheLineSize) std::atomic<uint32_t> m_limit;
+    Slot* m_slots;
+    uint64_t m_mask;
+};
+
+}  // end namespace dailycode
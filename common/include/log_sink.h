@@ -0,0 +1,143 @@
+/***************************************************************************
+*
+* Copyright (c) 2020 jackszhang, All Rights Reserved
+*
+* @file    log_sink.h
+* @author  jackszhang
+* @date    2020/11/15
+* @brief   The interface of log sink 日志输出目标
+*
+**************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace dailycode {
+
+#define kLogSinkAllLevels 0xffffffffu          // 接收所有级别
+#define LOG_SINK_LEVEL(level) (1u << (level))  // 按级别组合levelMask
+#define defaultLogSinkMaxPending 10000         // 每个输出目标默认最多积压的日志条数
+
+// 日志输出目标，文件之外的输出(终端、内存、回调等)都通过它扩展：
+// write/flush只在该目标自己的工作线程中调用，实现不需要考虑并发
+class LogSink {
+ public:
+    virtual ~LogSink() {}
+
+    // 一条完整的日志，不含换行
+    virtual void write(int32_t level, const char* data, size_t len) = 0;
+
+    // 一批日志写完后调用
+    virtual void flush() {}
+};
+
+// 输出到stdout，每批日志只fflush一次
+class ConsoleLogSink : public LogSink {
+ public:
+    virtual void write(int32_t level, const char* data, size_t len);
+    virtual void flush();
+};
+
+// 在内存中保留最近的maxLines条日志，供崩溃上报、调试界面等读取
+class MemoryLogSink : public LogSink {
+ public:
+    explicit MemoryLogSink(size_t maxLines) : m_maxLines(maxLines > 0 ? maxLines : 1) {}
+
+    virtual void write(int32_t level, const char* data, size_t len);
+
+    // 按时间顺序返回当前保留的日志，可在任意线程调用
+    std::vector<std::string> getLogs();
+
+ private:
+    std::mutex m_mutex;
+    std::deque<std::string> m_lines;
+    size_t m_maxLines;
+};
+
+// 每条日志回调一次用户函数
+class CallbackLogSink : public LogSink {
+ public:
+    typedef std::function<void(int32_t level, const char* data, size_t len)> Callback;
+
+    explicit CallbackLogSink(const Callback& callback) : m_callback(callback) {}
+
+    virtual void write(int32_t level, const char* data, size_t len) {
+        if (m_callback) {
+            m_callback(level, data, len);
+        }
+    }
+
+ private:
+    Callback m_callback;
+};
+
+// 输出目标的独立队列和工作线程：
+// 1. 日志线程把命中levelMask的日志追加到当前批次，每轮处理完队列后整批提交
+// 2. 积压超过maxPending条时直接丢弃并计数，慢的输出目标不会拖慢日志线程和其他目标
+// 3. stop或析构时写完已提交的日志再退出，stop之后提交的日志计入丢弃
+class LogSinkChannel {
+ public:
+    LogSinkChannel(int32_t id, const std::shared_ptr<LogSink>& sink, uint32_t levelMask,
+                   size_t maxPending);
+    ~LogSinkChannel();
+
+    int32_t id() const { return m_id; }
+    size_t maxPending() const { return m_maxPending; }
+    bool accept(int32_t level) const { return 0 != (m_levelMask & LOG_SINK_LEVEL(level)); }
+
+    // 以下两个接口只在日志线程调用
+    void append(int32_t level, const char* data, size_t len);
+    void submit();
+
+    // 写完已提交的日志后停止工作线程，之后提交的日志不再输出，计入dropped
+    void stop();
+
+    // 因积压丢弃的日志条数
+    uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+ private:
+    LogSinkChannel(const LogSinkChannel&);
+    LogSinkChannel& operator=(const LogSinkChannel&);
+
+    // 一批日志，正文连续存放，避免每条日志申请一次内存
+    struct Batch {
+        std::string text;
+        std::vector<std::pair<int32_t, uint32_t>> records;  // 级别 --> 长度
+    };
+
+    void workerFunc();
+    void writeBatch(const Batch& batch);
+
+ private:
+    int32_t m_id;
+    std::shared_ptr<LogSink> m_sink;
+    uint32_t m_levelMask;
+    size_t m_maxPending;
+
+    Batch m_pending;                      // 日志线程正在填充的批次
+    std::atomic<size_t> m_queuedCnt;      // 已提交未写完的条数
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<uint64_t> m_unreported;   // 尚未告知输出目标的丢弃条数
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<Batch> m_batches;
+    std::vector<Batch> m_freeBatches;     // 写完的批次，复用其内存
+    bool m_stop;
+    std::thread m_worker;
+};
+
+}  // end namespace dailycode
@@ -0,0 +1,311 @@
+/***************************************************************************
+*
+* Copyright (c) 2020 jackszhang, All Rights Reserved
+*
+* @file    log_stream.hpp
+* @author  jackszhang
+* @date    2020/10/25
+* @brief   The interface of log stream 流式日志的无分配格式化缓冲区
+*
+**************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <ios>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+namespace dailycode {
+
+#define kLogStreamInlineSize 512  // 栈上缓冲区大小，超出后才申请堆内存
+#define kLogStreamNumberMaxLen 32  // 单个数值转换后的最大长度
+
+// 无符号整数转十进制，两位一组查表，返回写入的长度
+inline size_t formatLogDecimal(char* dst, uint64_t value) {
+    static const char kDigitPairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char tmp[20];
+    char* p = tmp + sizeof(tmp);
+    while (value >= 100) {
+        size_t idx = (size_t)(value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        p[0] = kDigitPairs[idx];
+        p[1] = kDigitPairs[idx + 1];
+    }
+    if (value >= 10) {
+        size_t idx = (size_t)value * 2;
+        p -= 2;
+        p[0] = kDigitPairs[idx];
+        p[1] = kDigitPairs[idx + 1];
+    } else {
+        *--p = (char)('0' + value);
+    }
+    size_t len = tmp + sizeof(tmp) - p;
+    memcpy(dst, p, len);
+    return len;
+}
+
+// 无符号整数转小写十六进制(不带0x)，返回写入的长度
+inline size_t formatLogHex(char* dst, uint64_t value) {
+    static const char kHexDigits[] = "0123456789abcdef";
+    char tmp[16];
+    char* p = tmp + sizeof(tmp);
+    do {
+        *--p = kHexDigits[value & 0xf];
+        value >>= 4;
+    } while (value > 0);
+    size_t len = tmp + sizeof(tmp) - p;
+    memcpy(dst, p, len);
+    return len;
+}
+
+// 流式日志的正文缓冲区：
+// 1. 内容先写入对象内的定长数组，只有超长日志才扩容到堆上
+// 2. 常用类型直接转换成文本，不经过iostream；其余类型回退到std::ostringstream
+// 3. 输出格式与std::ostream的默认格式保持一致
+// 4. 出现操纵符(std::hex、std::setw等)或其他类型后，格式状态保存在m_format中，
+//    之后的内容都经过它格式化，与std::ostream的行为一致
+class LogStream {
+ public:
+    LogStream() : m_data(m_inline), m_len(0), m_cap(kLogStreamInlineSize), m_format(nullptr) {}
+
+    ~LogStream() {
+        if (m_data != m_inline) {
+            delete[] m_data;
+        }
+        delete m_format;
+    }
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_len; }
+
+    void append(const char* str, size_t len) {
+        memcpy(reserve(len), str, len);
+        m_len += len;
+    }
+
+    LogStream& operator<<(const char* str) {
+        if (m_format) {
+            return appendFormatted(str ? str : "(null)");
+        }
+        if (str) {
+            append(str, strlen(str));
+        } else {
+            // 与std::ostream不同，空指针不会置位badbit，而是输出(null)
+            append("(null)", 6);
+        }
+        return *this;
+    }
+    LogStream& operator<<(char* str) { return *this << (const char*)str; }
+    LogStream& operator<<(const std::string& str) {
+        if (m_format) {
+            return appendFormatted(str);
+        }
+        append(str.data(), str.size());
+        return *this;
+    }
+
+    LogStream& operator<<(char value) {
+        if (m_format) {
+            return appendFormatted(value);
+        }
+        append(&value, 1);
+        return *this;
+    }
+    LogStream& operator<<(signed char value) { return *this << (char)value; }
+    LogStream& operator<<(unsigned char value) { return *this << (char)value; }
+    LogStream& operator<<(bool value) {
+        if (m_format) {
+            return appendFormatted(value);
+        }
+        return *this << (value ? '1' : '0');
+    }
+
+    // 有格式状态时按原类型交给m_format，例如std::hex对short和int的输出不同
+    LogStream& operator<<(short value) {
+        return m_format ? appendFormatted(value) : appendSigned(value);
+    }
+    LogStream& operator<<(int value) {
+        return m_format ? appendFormatted(value) : appendSigned(value);
+    }
+    LogStream& operator<<(long value) {
+        return m_format ? appendFormatted(value) : appendSigned(value);
+    }
+    LogStream& operator<<(long long value) {
+        return m_format ? appendFormatted(value) : appendSigned(value);
+    }
+    LogStream& operator<<(unsigned short value) {
+        return m_format ? appendFormatted(value) : appendUnsigned(value);
+    }
+    LogStream& operator<<(unsigned int value) {
+        return m_format ? appendFormatted(value) : appendUnsigned(value);
+    }
+    LogStream& operator<<(unsigned long value) {
+        return m_format ? appendFormatted(value) : appendUnsigned(value);
+    }
+    LogStream& operator<<(unsigned long long value) {
+        return m_format ? appendFormatted(value) : appendUnsigned(value);
+    }
+
+    // 浮点数与std::ostream默认格式(%g)一致，直接写入缓冲区
+    LogStream& operator<<(float value) {
+        return m_format ? appendFormatted(value) : appendDouble(value);
+    }
+    LogStream& operator<<(double value) {
+        return m_format ? appendFormatted(value) : appendDouble(value);
+    }
+    LogStream& operator<<(long double value) {
+        if (m_format) {
+            return appendFormatted(value);
+        }
+        char* dst = reserve(kLogStreamNumberMaxLen);
+        int ret = snprintf(dst, kLogStreamNumberMaxLen, "%Lg", value);
+        m_len += ret > 0 ? std::min((size_t)ret, (size_t)kLogStreamNumberMaxLen - 1) : 0;
+        return *this;
+    }
+
+    // 指针按十六进制输出，空指针输出0，与std::ostream一致
+    LogStream& operator<<(const void* ptr) {
+        if (m_format) {
+            return appendFormatted(ptr);
+        }
+        char* dst = reserve(kLogStreamNumberMaxLen);
+        if (!ptr) {
+            *dst = '0';
+            m_len += 1;
+            return *this;
+        }
+        dst[0] = '0';
+        dst[1] = 'x';
+        m_len += 2 + formatLogHex(dst + 2, (uint64_t)(uintptr_t)ptr);
+        return *this;
+    }
+    template <typename T>
+    LogStream& operator<<(T* ptr) {
+        return *this << (const void*)ptr;
+    }
+
+    // std::hex、std::fixed等只修改格式状态
+    LogStream& operator<<(std::ios_base& (*manip)(std::ios_base&)) {
+        manip(formatStream());
+        return *this;
+    }
+    // std::endl、std::ends等会输出字符
+    LogStream& operator<<(std::ostream& (*manip)(std::ostream&)) {
+        manip(formatStream());
+        takeFormatted();
+        return *this;
+    }
+
+    // 枚举按整数输出，其余类型使用自定义的operator<<(std::ostream&, const T&)
+    template <typename T>
+    LogStream& operator<<(const T& value) {
+        appendOther(value, std::is_enum<T>());
+        return *this;
+    }
+
+ private:
+    LogStream(const LogStream&);
+    LogStream& operator=(const LogStream&);
+
+    // 保证还有len字节的空间，返回写入位置
+    char* reserve(size_t len) {
+        if (m_len + len > m_cap) {
+            size_t cap = m_cap * 2;
+            while (cap < m_len + len) {
+                cap *= 2;
+            }
+            char* data = new char[cap];
+            memcpy(data, m_data, m_len);
+            if (m_data != m_inline) {
+                delete[] m_data;
+            }
+            m_data = data;
+            m_cap = cap;
+        }
+        return m_data + m_len;
+    }
+
+    LogStream& appendSigned(int64_t value) {
+        char* dst = reserve(kLogStreamNumberMaxLen);
+        uint64_t absValue = (uint64_t)value;
+        if (value < 0) {
+            *dst++ = '-';
+            m_len += 1;
+            absValue = 0 - absValue;
+        }
+        m_len += formatLogDecimal(dst, absValue);
+        return *this;
+    }
+
+    LogStream& appendUnsigned(uint64_t value) {
+        m_len += formatLogDecimal(reserve(kLogStreamNumberMaxLen), value);
+        return *this;
+    }
+
+    LogStream& appendDouble(double value) {
+        char* dst = reserve(kLogStreamNumberMaxLen);
+        int ret = snprintf(dst, kLogStreamNumberMaxLen, "%g", value);
+        m_len += ret > 0 ? std::min((size_t)ret, (size_t)kLogStreamNumberMaxLen - 1) : 0;
+        return *this;
+    }
+
+    template <typename T>
+    void appendOther(const T& value, std::true_type) {
+        typedef typename std::underlying_type<T>::type Underlying;
+        if (std::is_signed<Underlying>::value) {
+            appendSigned((int64_t)value);
+        } else {
+            appendUnsigned((uint64_t)value);
+        }
+    }
+
+    // 其余类型(包括std::setw、std::setprecision等带参数的操纵符)都经过m_format，
+    // 操纵符设置的状态对之后的内容生效
+    template <typename T>
+    void appendOther(const T& value, std::false_type) {
+        formatStream() << value;
+        takeFormatted();
+    }
+
+    std::ostringstream& formatStream() {
+        if (!m_format) {
+            m_format = new std::ostringstream();
+        }
+        return *m_format;
+    }
+
+    template <typename T>
+    LogStream& appendFormatted(const T& value) {
+        *m_format << value;
+        takeFormatted();
+        return *this;
+    }
+
+    // 把m_format中格式化好的内容移到缓冲区，保留格式状态
+    void takeFormatted() {
+        const std::string& str = m_format->str();
+        append(str.data(), str.size());
+        m_format->str(std::string());
+    }
+
+ private:
+    char m_inline[kLogStreamInlineSize];
+    char* m_data;
+    size_t m_len;
+    size_t m_cap;
+    std::ostringstream* m_format;  // 第一次出现操纵符或其他类型时才创建
+};
+
+}  // end namespace dailycode
@@ -0,0 +1,52 @@
+/***************************************************************************
+*
+* Copyright (c) 2020 jackszhang, All Rights Reserved
+*
+* @file    log_writer.h
+* @author  jackszhang
+* @date    2020/10/25
+* @brief   The interface of log writer 日志文件写入后端
+*
+**************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <memory>
+
+namespace dailycode {
+
+// 日志文件写入方式
+enum LogWriterMode {
+    LWM_SYNC = 0,   // 日志线程直接write，写完才返回
+    LWM_ASYNC = 1,  // io_uring异步写，内核不支持时退化为pwrite线程池
+    LWM_MMAP = 2,   // 文件预分配到最大大小后mmap，日志线程直接memcpy，没有write调用
+};
+
+// 日志文件写入后端，只在日志线程中使用：
+// 1. openFile打开文件后attach，关闭文件前detach，detach返回后才能close
+// 2. write提交一批数据，返回后data即可复用，异步后端在后台完成真正的写入
+class LogWriter {
+ public:
+    virtual ~LogWriter() {}
+
+    // 绑定打开的文件，offset为文件当前大小，之后的数据追加在offset之后，
+    // maxSize为文件滚动前的最大大小，供需要预分配的后端使用
+    virtual bool attach(int fd, uint64_t offset, uint64_t maxSize) = 0;
+
+    // 追加一批数据，之前的异步写失败时返回false
+    virtual bool write(const char* data, size_t len) = 0;
+
+    // 等待已提交的数据全部写完并解绑文件
+    virtual void detach() = 0;
+
+    // 已提交的数据对应的文件大小
+    virtual uint64_t offset() const = 0;
+
+    // 按mode创建写入后端，directIo仅对异步写生效
+    static std::shared_ptr<LogWriter> create(int32_t mode, bool directIo);
+};
+
+}  // end namespace dailycode
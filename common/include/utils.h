@@ -8,21 +8,45 @@
 * @brief   The interface of utils
 *
 **************************************************************************/
+#pragma once
+
 #include <map>
 #include <vector>
 #include <string>
 #include <stdint.h>
+#include <time.h>
 
 namespace dailycode {
+
+// 时间格式化选项，可按位组合
+enum TimeFormatFlag {
+    TF_WITH_MSEC = 0,         // 精确到毫秒 2020-10-25 12:00:00.123
+    TF_WITH_USEC = 1,         // 精确到微秒 2020-10-25 12:00:00.123456
+    TF_COARSE_CLOCK = 1 << 1  // 使用CLOCK_REALTIME_COARSE，精度为一个tick，但开销更低
+};
+
+#define kSystemTimeMaxLen 26  // "YYYY-mm-dd HH:MM:SS.uuuuuu"
+
 class Utils {
  public:
     static const std::string getCurrentSystemTime();
+    // 格式化当前时间到buf，按线程缓存秒级文本，仅更新毫秒/微秒部分，
+    // 返回写入的长度(不追加'\0')
+    static size_t formatSystemTime(char* buf, size_t len, int32_t flags = TF_WITH_MSEC);
+    // 按flags选择的时钟读取当前时间，以及格式化指定时间，用于延迟格式化的日志
+    static void getRealTime(struct timespec& curTime, int32_t flags = TF_WITH_MSEC);
+    static size_t formatTime(const struct timespec& curTime, char* buf, size_t len,
+                             int32_t flags = TF_WITH_MSEC);
     static const std::string getCurrentSystemDate();
     static uint32_t getTickCount();
+    // 读取/dev/urandom，失败时退化为时间和进程号的组合
+    static uint64_t getRandomSeed();
     static const void split(std::string target, std::string delimter,
                             std::vector<std::string>& res);
     static bool mkdirRecursive(const std::string path);
-    static void getDirFiles(std::string path, std::vector<std::string>& res);
+    // 只返回以prefix开头的文件名，一次readdir遍历完成过滤
+    static void getDirFiles(std::string path, std::vector<std::string>& res,
+                            const std::string& prefix = "");
     static bool isDigit(const std::string num);
 
     static bool isBiggerUint32(uint32_t src, uint32_t dest);
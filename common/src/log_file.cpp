@@ -17,17 +17,169 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <cctype>
+#include <algorithm>
+#include <chrono>
 #include "log_file.h"
 #include "utils.h"
 #include "zip.h"
 #include "unzip.h"
 #include "xor.h"
 #include "blowfish.h"
+#include "aes.h"
 
 namespace dailycode {
 
-bool LogFile::m_isInit = false;
+#define kLogDrainBatchCnt 1024  // 日志线程每批次最多取出的日志条数
+#define kLogWriteBufferMinSize (64 * 1024)  // 批量写缓冲区的预留大小
+#define kLogWriterIdleWaitMs 1000            // 没有待写数据时日志线程的最长休眠时间
+#define kLogPackSuffix ".zip"                // 滚动后单独压缩的文件后缀，例如test_2020-10-01_1245.log.zip
+#define kLogFreshFileTries 16                // 滚动时直接创建新文件遇到同名文件的最大重试次数
+#define kLogPackNice 19                      // 压缩线程的nice值，只在CPU空闲时压缩
+
+std::atomic<bool> LogFile::m_isInit(false);
+std::atomic<int32_t> LogFile::m_activeProducers(0);
+std::atomic<int32_t> LogFile::m_logLevel(defaultLogLevel);
+std::atomic<uint64_t> LogFile::m_logConfVersion(0);
+
+// 每个线程缓存的配置快照及其版本号
+struct LogConfCache {
+    uint64_t version;
+    std::shared_ptr<const LogConfig> conf;
+};
+
+static thread_local LogConfCache tlsLogConfCache = {0, nullptr};
+
+static inline bool hasSuffix(const std::string& str, const char* suffix) {
+    size_t len = strlen(suffix);
+    return str.size() >= len && 0 == str.compare(str.size() - len, len, suffix);
+}
+
+// 解析滚动后的日志文件名，格式为logName_日期_时间戳.log，例如test_2020-10-01_1245.log，
+// 滚动后压缩过的文件再加上.zip后缀
+static bool parseLogFileStamp(const std::string& file, const std::string& logName,
+                              uint32_t& stamp) {
+    size_t suffixLen = 4;  // ".log"
+    if (hasSuffix(file, ".log" kLogPackSuffix)) {
+        suffixLen += strlen(kLogPackSuffix);
+    }
+    if (file.size() <= logName.size() + 1 + suffixLen ||
+        0 != file.compare(0, logName.size(), logName) || '_' != file[logName.size()] ||
+        0 != file.compare(file.size() - suffixLen, 4, ".log")) {
+        return false;
+    }
+    size_t datePos = logName.size() + 1;
+    size_t stampPos = file.rfind('_', file.size() - suffixLen - 1);
+    if (stampPos == std::string::npos || stampPos <= datePos ||
+        file.find('_', datePos) != stampPos) {
+        return false;
+    }
+    std::string digits = file.substr(stampPos + 1, file.size() - suffixLen - stampPos - 1);
+    if (digits.empty() || digits.size() > 10 || !Utils::isDigit(digits)) {
+        return false;
+    }
+    stamp = (uint32_t)std::stoul(digits);
+    return true;
+}
+
+// stat中的修改时间，单位纳秒
+static inline int64_t getMtimeNs(const struct stat& st) {
+    return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// 滚动后的日志文件名，例如test_2020-10-01_1245.log
+static std::string buildStampFileName(const std::string& logFileName, uint32_t stamp) {
+    return logFileName + "_" + Utils::getCurrentSystemDate() + "_" + std::to_string(stamp) +
+           ".log";
+}
+
+// 压缩大文件时使用的线程数，0表示按CPU核数
+static unsigned int getZipThreads(const LogConfig& conf) {
+    int threads = conf.intConf[LC_LOG_ZIP_THREADS];
+    if (threads <= 0) {
+        threads = (int)std::thread::hardware_concurrency();
+    }
+    return threads > 0 ? (unsigned int)threads : 1;
+}
+
+// 只读映射整个文件，失败或空文件返回NULL，用完后munmap
+static const char* mapWholeFile(const std::string& file, size_t& size) {
+    struct stat st;
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    void* addr = MAP_FAILED;
+    if (0 == fstat(fd, &st) && st.st_size > 0) {
+        addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+    size = (size_t)st.st_size;
+    return (const char*)addr;
+}
+
+static inline uint32_t getZipU16(const char* src) {
+    return (uint32_t)(unsigned char)src[0] | ((uint32_t)(unsigned char)src[1] << 8);
+}
+
+static inline uint32_t getZipU32(const char* src) {
+    return getZipU16(src) | (getZipU16(src + 2) << 16);
+}
+
+// 解析zip中第一个条目的本地文件头，用于直接拷贝滚动后压缩好的数据。
+// 只支持文件头中已有crc和大小、未加密的条目，即ZipAdd写入普通文件的结果
+static bool parseZipEntry(const char* data, size_t size, const struct stat& st, ZIPRAW& raw) {
+    const size_t headLen = 30;
+    if (size < headLen || 0x04034b50 != getZipU32(data)) {
+        return false;
+    }
+    uint32_t flag = getZipU16(data + 6);
+    uint32_t nameLen = getZipU16(data + 26);
+    uint32_t extraLen = getZipU16(data + 28);
+    if (0 != (flag & 9)) {
+        return false;
+    }
+    raw.flag = (unsigned short)flag;
+    raw.method = (unsigned short)getZipU16(data + 8);
+    raw.timestamp = getZipU16(data + 10) | (getZipU16(data + 12) << 16);
+    raw.crc = getZipU32(data + 14);
+    raw.csize = getZipU32(data + 18);
+    raw.usize = getZipU32(data + 22);
+    raw.offset = headLen + nameLen + extraLen;
+    if (raw.offset + (uint64_t)raw.csize > size) {
+        return false;
+    }
+    // 与ZipAdd一致：高16位为unix属性，最低位表示只读
+    raw.attr = ((st.st_mode & 0xFFFF) << 16) | ((st.st_mode & S_IWUSR) ? 0 : 1);
+    raw.mtime = (unsigned long)st.st_mtime;
+    const char* extra = data + headLen + nameLen;
+    if (extraLen >= 9 && 'U' == extra[0] && 'T' == extra[1] && (extra[4] & 1)) {
+        raw.mtime = getZipU32(extra + 5);
+    }
+    return true;
+}
+
+// 每个线程独立的格式化缓冲区，只增不减
+static thread_local std::string tlsLogBuffer;
+
+// 向定长缓冲区追加内容，超出部分截断，返回追加后的长度
+static inline size_t appendToBuffer(char* buf, size_t len, size_t cap, const char* str,
+                                    size_t strLen) {
+    if (len + strLen > cap) {
+        strLen = cap > len ? cap - len : 0;
+    }
+    memcpy(buf + len, str, strLen);
+    return len + strLen;
+}
 
 void LogFile::Init() {
     LogFile* logFilePtr = SingleTon<LogFile>::Instance();
@@ -37,26 +189,67 @@ void LogFile::Init() {
                 Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__);
         return;
     }
-    logFilePtr->m_logConfIntMap[LC_LOG_LEVEL] = defaultLogLevel;
-    logFilePtr->m_logConfIntMap[LC_LOG_ROW_LENGTH] = defaultLogRowLength;
-    logFilePtr->m_logConfIntMap[LC_LOG_FILE_MAX_NUM] = defaultLogFilesMaxCnt;
-    logFilePtr->m_logConfIntMap[LC_LOG_FILE_MAX_SIEZ] = defaultLogMaxFileSize;
-    logFilePtr->m_logConfIntMap[LC_LOG_NEED_REGULAR_CLEAN] = defaultLogNeedClear;
-    logFilePtr->m_logConfIntMap[LC_LOG_NEED_PRINT_CONSOLE] = defaultLogNeedPrintConsole;
-    logFilePtr->m_logConfIntMap[LC_LOG_NEED_ENCRYPTION] = defauleLogNeedEncryption;
-    logFilePtr->m_logConfIntMap[LC_LOG_MAX_CONCURRENT_CNT] = defaultLogMaxConcurrentCnt;
-    logFilePtr->m_logConfIntMap[LC_LOG_ENABLE_COMPRESS] = defauleLogEnableCompress;
-    logFilePtr->m_logConfIntMap[LC_LOG_COMPRESS_INTERVAL] = defauleLogCompressInterval;
-
-    logFilePtr->m_logConfStrMap[LC_LOG_OUTPUT_PATH] = defaultLogOutputPath;
-    logFilePtr->m_logConfStrMap[LC_LOG_FILE_NAME] = defaultLogFileName;
-    logFilePtr->m_logConfStrMap[LC_LOG_APP_NAME] = defaultAppName;
-
-    logFilePtr->m_logBuffer = new char[defaultLogRowLength];
-    logFilePtr->m_logBuffer[defaultLogRowLength - 1] = '\0';
-
-    logFilePtr->m_logFd = nullptr;
+    std::shared_ptr<LogConfig> conf(new LogConfig());
+    conf->intConf[LC_LOG_LEVEL] = defaultLogLevel;
+    conf->intConf[LC_LOG_ROW_LENGTH] = defaultLogRowLength;
+    conf->intConf[LC_LOG_FILE_MAX_NUM] = defaultLogFilesMaxCnt;
+    conf->intConf[LC_LOG_FILE_MAX_SIEZ] = defaultLogMaxFileSize;
+    conf->intConf[LC_LOG_NEED_REGULAR_CLEAN] = defaultLogNeedClear;
+    conf->intConf[LC_LOG_NEED_PRINT_CONSOLE] = defaultLogNeedPrintConsole;
+    conf->intConf[LC_LOG_NEED_ENCRYPTION] = defauleLogNeedEncryption;
+    conf->intConf[LC_LOG_MAX_CONCURRENT_CNT] = defaultLogMaxConcurrentCnt;
+    conf->intConf[LC_LOG_ENABLE_COMPRESS] = defauleLogEnableCompress;
+    conf->intConf[LC_LOG_COMPRESS_INTERVAL] = defauleLogCompressInterval;
+    conf->intConf[LC_LOG_TIME_FORMAT] = defaultLogTimeFormat;
+    conf->intConf[LC_LOG_FLUSH_BYTES] = defaultLogFlushBytes;
+    conf->intConf[LC_LOG_FLUSH_INTERVAL] = defaultLogFlushInterval;
+    conf->intConf[LC_LOG_FLUSH_ON_ERROR] = defaultLogFlushOnError;
+    conf->intConf[LC_LOG_OVERFLOW_POLICY] = defaultLogOverflowPolicy;
+    conf->intConf[LC_LOG_BLOCK_TIMEOUT] = defaultLogBlockTimeout;
+    conf->intConf[LC_LOG_MAX_QUEUE_BYTES] = defaultLogMaxQueueBytes;
+    conf->intConf[LC_LOG_SHED_WATERMARK] = defaultLogShedWatermark;
+    conf->intConf[LC_LOG_WRITER_MODE] = defaultLogWriterMode;
+    conf->intConf[LC_LOG_DIRECT_IO] = defaultLogDirectIo;
+    conf->intConf[LC_LOG_WATCH_DIR] = defaultLogWatchDir;
+    conf->intConf[LC_LOG_COMPRESS_ON_ROTATE] = defaultLogCompressOnRotate;
+    conf->intConf[LC_LOG_FILES_MAX_BYTES] = defaultLogFilesMaxBytes;
+    conf->intConf[LC_LOG_ZIP_SAVE_FILE] = defaultLogZipSaveFile;
+    conf->intConf[LC_LOG_ZIP_THREADS] = defaultLogZipThreads;
+    conf->intConf[LC_LOG_CONSOLE_PENDING] = defaultLogConsoleMaxPending;
+
+    conf->strConf[LC_LOG_OUTPUT_PATH] = defaultLogOutputPath;
+    conf->strConf[LC_LOG_FILE_NAME] = defaultLogFileName;
+    conf->strConf[LC_LOG_APP_NAME] = defaultAppName;
+    conf->logPrefix = logFilePtr->buildLogPrefix(defaultAppName);
+
+    logFilePtr->m_logLevel.store(defaultLogLevel);
+    logFilePtr->publishConf(conf);
+
+    logFilePtr->m_logFd = -1;
+    logFilePtr->m_dirWatchFd = -1;
+    logFilePtr->m_batchEncType = ET_NO_ENCRYPTION;
+    logFilePtr->m_batchRecordCnt = 0;
+    logFilePtr->m_batchSeq = 0;
+    logFilePtr->m_ivSeed = Utils::getRandomSeed();
+    logFilePtr->m_spareFd = -1;
+    logFilePtr->m_liveSpares.clear();
+    logFilePtr->m_houseBusy = false;
+    logFilePtr->m_houseStop = false;
+    logFilePtr->m_packStop = false;
+    logFilePtr->m_writerMode = -1;
+    logFilePtr->m_writerDirectIo = -1;
+    logFilePtr->m_curFileSize = 0;
+    logFilePtr->m_freshFileSeq = 0;
+    logFilePtr->m_lastRotateStamp = 0;
+    logFilePtr->m_needFlush = false;
+    logFilePtr->m_lastFlushStamp = Utils::getTickCount();
+    logFilePtr->m_writeBuffer.reserve(kLogWriteBufferMinSize);
+    logFilePtr->m_zipPending = false;
     logFilePtr->m_lastCompressStamp = 0;
+    logFilePtr->clearZipCache();
+
+    logFilePtr->m_allLogs = std::shared_ptr<MpscRingBuffer<LogRecord>>(
+        new MpscRingBuffer<LogRecord>(defaultLogMaxConcurrentCnt));
 
     logFilePtr->m_encryptTools[ET_XOR_ENCRYPTION] = std::shared_ptr<Xor>(new Xor());
     std::string key = std::string(defaultXorEncryptKey);
@@ -68,7 +261,28 @@ void LogFile::Init() {
     logFilePtr->m_encryptTools[ET_BLOWFISH_ENCRYPTION]
         ->setKey((const unsigned char*)key.c_str(), key.size());
 
+    logFilePtr->m_encryptTools[ET_AES_ENCRYPTION] = std::shared_ptr<Aes>(new Aes());
+    key = std::string(defaultAesEncryptKey);
+    logFilePtr->m_encryptTools[ET_AES_ENCRYPTION]
+        ->setKey((const unsigned char*)key.c_str(), key.size());
+
+    std::atomic_store(&logFilePtr->m_sinks,
+                      std::shared_ptr<const LogSinkList>(new LogSinkList()));
+    logFilePtr->m_nextSinkId = 0;
+
+    logFilePtr->m_writerSleeping.store(false);
+    logFilePtr->m_writerBusyUs.store(0);
+    logFilePtr->m_writerIdleUs.store(0);
+    logFilePtr->m_writerWakeups.store(0);
+    logFilePtr->m_spaceWaiters.store(0);
+    logFilePtr->m_evictRequests.store(0);
+    logFilePtr->m_queueBytes.store(0);
+    logFilePtr->m_droppedLogs.store(0);
     logFilePtr->m_stopThreadFlag.store(false);
+    logFilePtr->m_houseThread =
+        std::make_shared<std::thread>(std::thread(&LogFile::houseKeepFunc, logFilePtr));
+    logFilePtr->m_packThread =
+        std::make_shared<std::thread>(std::thread(&LogFile::packFunc, logFilePtr));
     logFilePtr->m_logThread =
         std::make_shared<std::thread>(std::thread(&LogFile::threadFunc, logFilePtr));
     LogFile::m_isInit = true;
@@ -85,25 +299,87 @@ void LogFile::DeInit() {
         }
         LogFile::m_isInit = false;
     }
-    logFilePtr->m_stopThreadFlag.store(true);
+    {
+        std::lock_guard<std::mutex> lock(logFilePtr->m_wakeMutex);
+        logFilePtr->m_stopThreadFlag.store(true);
+        logFilePtr->m_wakeCond.notify_one();
+    }
+    logFilePtr->notifyProducers();
+    // 已经通过m_isInit检查的生产者还在使用队列和配置，等它们全部退出
+    while (m_activeProducers.load() > 0) {
+        logFilePtr->notifyProducers();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
     logFilePtr->m_logThread->join();
+    // 压缩线程会向维护线程提交任务，需要先停止，未开始的压缩留到下次滚动时不再处理
+    {
+        std::lock_guard<std::mutex> lock(logFilePtr->m_packMutex);
+        logFilePtr->m_packStop = true;
+        logFilePtr->m_packTasks.clear();
+    }
+    logFilePtr->m_packCond.notify_all();
+    logFilePtr->m_packThread->join();
+    // 日志线程退出后，执行完剩余的改名和清理任务
+    {
+        std::lock_guard<std::mutex> lock(logFilePtr->m_houseMutex);
+        logFilePtr->m_houseStop = true;
+    }
+    logFilePtr->m_houseCond.notify_all();
+    logFilePtr->m_houseThread->join();
+    // 输出目标析构时写完已提交的日志
+    logFilePtr->m_writerSinks.reset();
+    logFilePtr->m_consoleSink.reset();
+    std::atomic_store(&logFilePtr->m_sinks, std::shared_ptr<const LogSinkList>());
     {
         std::lock_guard<std::mutex> lock(logFilePtr->m_logMutex);
         logFilePtr->m_encryptTools.clear();
+        logFilePtr->m_allLogs.reset();
+        logFilePtr->m_zipPending = false;
         logFilePtr->m_lastCompressStamp = 0;
-        if (logFilePtr->m_logFd) {
-            fclose(logFilePtr->m_logFd);
-        }
-        if (logFilePtr->m_logBuffer) {
-            delete[] logFilePtr->m_logBuffer;
-        }
-
-        logFilePtr->m_logConfStrMap.clear();
-        logFilePtr->m_logConfIntMap.clear();
+        logFilePtr->clearZipCache();
+        logFilePtr->closeFile();
+        logFilePtr->m_writer.reset();
+        logFilePtr->closeDirWatch();
+        logFilePtr->m_allFiles.clear();
+        logFilePtr->m_indexedLogDir.clear();
+        // 日志线程已退出，此时才能撤掉配置，保证退出前的日志都能写完
+        logFilePtr->m_writerConf.reset();
+        logFilePtr->publishConf(nullptr);
     }
     logFilePtr->Release();
 }
 
+const std::shared_ptr<const LogConfig>& LogFile::currentConf() {
+    LogConfCache& cache = tlsLogConfCache;
+    uint64_t version = m_logConfVersion.load(std::memory_order_acquire);
+    if (cache.version != version) {
+        cache.conf = std::atomic_load(&m_logConf);
+        cache.version = version;
+    }
+    return cache.conf;
+}
+
+std::shared_ptr<LogConfig> LogFile::copyConf() {
+    std::shared_ptr<const LogConfig> conf = std::atomic_load(&m_logConf);
+    if (!conf) {
+        return nullptr;
+    }
+    return std::shared_ptr<LogConfig>(new LogConfig(*conf));
+}
+
+void LogFile::publishConf(const std::shared_ptr<LogConfig>& conf) {
+    std::atomic_store(&m_logConf, std::shared_ptr<const LogConfig>(conf));
+    m_logConfVersion.fetch_add(1, std::memory_order_release);
+}
+
+std::string LogFile::buildLogPrefix(const std::string& appName) {
+    char prefix[256];
+    int len = snprintf(prefix, sizeof(prefix), " %s [%d:%p] ", appName.c_str(),
+                       (int32_t)getpid(), (void*)this);
+    len = std::min(std::max(len, 0), (int)sizeof(prefix) - 1);
+    return std::string(prefix, len);
+}
+
 void LogFile::set(const int32_t key, const int32_t value) {
     std::lock_guard<std::mutex> lock(m_logMutex);
     if (!LogFile::m_isInit) {
@@ -111,23 +387,35 @@ void LogFile::set(const int32_t key, const int32_t value) {
                 Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__);
         return;
     }
-    if (key == LC_LOG_ROW_LENGTH && m_logConfIntMap[key] != value) {
-        delete[] m_logBuffer;
-        m_logBuffer = new char[value];
-        m_logBuffer[value - 1] = '\0';
+    if (key < 0 || key >= LC_LOG_CONF_INT_CNT) {
+        return;
+    }
+    std::shared_ptr<LogConfig> conf = copyConf();
+    conf->intConf[key] = value;
+    if (key == LC_LOG_MAX_CONCURRENT_CNT && value > 0) {
+        // 队列槽位在Init时预分配，超过槽位数的上限会被截断
+        uint32_t limit = m_allLogs->setLimit(value);
+        if (limit != (uint32_t)value) {
+            fprintf(stderr, "%s [ERROR] %s-%d max concurrent cnt %d exceeds ring slots, use %u\n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, value, limit);
+        }
+        conf->intConf[key] = limit;
+    }
+    publishConf(conf);
+    if (key == LC_LOG_LEVEL) {
+        m_logLevel.store(value);
     }
-    m_logConfIntMap[key] = value;
 }
 
 int32_t LogFile::getIntConf(const int32_t key, const int32_t defaultValue) {
-    std::lock_guard<std::mutex> lock(m_logMutex);
-    if (!LogFile::m_isInit) {
+    const std::shared_ptr<const LogConfig>& conf = currentConf();
+    if (!conf) {
         fprintf(stderr, "%s [ERROR] %s-%d LogFile not init\n",
                 Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__);
         return 0;
     }
-    if (m_logConfIntMap.find(key) != m_logConfIntMap.end()) {
-        return m_logConfIntMap[key];
+    if (key >= 0 && key < LC_LOG_CONF_INT_CNT) {
+        return conf->intConf[key];
     }
     return defaultValue;
 }
@@ -139,18 +427,26 @@ void LogFile::set(const int32_t key, const std::string value) {
                 Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__);
         return;
     }
-    m_logConfStrMap[key] = value;
+    if (key < 0 || key >= LC_LOG_CONF_STR_CNT) {
+        return;
+    }
+    std::shared_ptr<LogConfig> conf = copyConf();
+    conf->strConf[key] = value;
+    if (key == LC_LOG_APP_NAME) {
+        conf->logPrefix = buildLogPrefix(value);
+    }
+    publishConf(conf);
 }
 
 std::string LogFile::getStrConf(const int32_t key, const std::string defaultValue) {
-    std::lock_guard<std::mutex> lock(m_logMutex);
-    if (!LogFile::m_isInit) {
+    const std::shared_ptr<const LogConfig>& conf = currentConf();
+    if (!conf) {
         fprintf(stderr, "%s [ERROR] %s-%d LogFile not init\n",
                 Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__);
         return "LogNotInit";
     }
-    if (m_logConfStrMap.find(key) != m_logConfStrMap.end()) {
-        return m_logConfStrMap[key];
+    if (key >= 0 && key < LC_LOG_CONF_STR_CNT) {
+        return conf->strConf[key];
     }
     return defaultValue;
 }
@@ -163,20 +459,23 @@ void LogFile::setEncryptKey(const int32_t encryptType, const std::string encrypt
         return;
     }
 
-    if (0 == m_logConfIntMap[LC_LOG_NEED_ENCRYPTION] || ET_NO_ENCRYPTION == encryptType) {
+    if (0 == currentConf()->intConf[LC_LOG_NEED_ENCRYPTION] || ET_NO_ENCRYPTION == encryptType) {
         fprintf(stderr, "%s [ERROR] %s-%d LogFile disable encrypt\n",
                 Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__);
         return;
     }
 
-    if (ET_XOR_ENCRYPTION != encryptType && ET_BLOWFISH_ENCRYPTION != encryptType) {
+    if (ET_XOR_ENCRYPTION != encryptType && ET_BLOWFISH_ENCRYPTION != encryptType &&
+        ET_AES_ENCRYPTION != encryptType) {
         return;
     }
     if (m_encryptTools.find(encryptType) == m_encryptTools.end()) {
         if (ET_XOR_ENCRYPTION == encryptType) {
             m_encryptTools[ET_XOR_ENCRYPTION] = std::shared_ptr<Xor>(new Xor());
-        } else if (ET_BLOWFISH_ENCRYPTION) {
+        } else if (ET_BLOWFISH_ENCRYPTION == encryptType) {
             m_encryptTools[ET_BLOWFISH_ENCRYPTION] = std::shared_ptr<Blowfish>(new Blowfish());
+        } else if (ET_AES_ENCRYPTION == encryptType) {
+            m_encryptTools[ET_AES_ENCRYPTION] = std::shared_ptr<Aes>(new Aes());
         } else {
             return;
         }
@@ -194,13 +493,14 @@ std::string LogFile::getEncryptKey(const int32_t encryptType) {
         return "";
     }
 
-    if (m_logConfIntMap[LC_LOG_NEED_ENCRYPTION] == 0 || ET_NO_ENCRYPTION == encryptType) {
+    if (currentConf()->intConf[LC_LOG_NEED_ENCRYPTION] == 0 || ET_NO_ENCRYPTION == encryptType) {
         fprintf(stderr, "%s [ERROR] %s-%d LogFile disable encrypt\n",
                 Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__);
         return "";
     }
 
-    if (ET_XOR_ENCRYPTION != encryptType && ET_BLOWFISH_ENCRYPTION != encryptType) {
+    if (ET_XOR_ENCRYPTION != encryptType && ET_BLOWFISH_ENCRYPTION != encryptType &&
+        ET_AES_ENCRYPTION != encryptType) {
         return "";
     }
 
@@ -214,154 +514,650 @@ void LogFile::addZipRequest(std::shared_ptr<ZipLogCallBack> callBack) {
     std::lock_guard<std::mutex> lock(m_zipMutex);
     std::weak_ptr<ZipLogCallBack> wpCallback(callBack);
     m_zipCallBacks.insert(wpCallback);
+    notifyWriter();
 }
 
-void LogFile::recviveOneLog(LogLevel level, const char* levelStr, const char* fileName,
-                            const char* format, ...) {
+LogWriterStats LogFile::getWriterStats() {
+    LogWriterStats stats;
+    stats.busyUs = m_writerBusyUs.load(std::memory_order_relaxed);
+    stats.idleUs = m_writerIdleUs.load(std::memory_order_relaxed);
+    stats.wakeups = m_writerWakeups.load(std::memory_order_relaxed);
+    return stats;
+}
+
+int32_t LogFile::addSink(std::shared_ptr<LogSink> sink, uint32_t levelMask, size_t maxPending) {
     std::lock_guard<std::mutex> lock(m_logMutex);
+    if (!LogFile::m_isInit || !sink) {
+        fprintf(stderr, "%s [ERROR] %s-%d LogFile not init or sink is null\n",
+                Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__);
+        return -1;
+    }
+    int32_t sinkId = m_nextSinkId++;
+    std::shared_ptr<LogSinkList> sinks(new LogSinkList(*std::atomic_load(&m_sinks)));
+    sinks->push_back(std::shared_ptr<LogSinkChannel>(
+        new LogSinkChannel(sinkId, sink, levelMask, maxPending)));
+    std::atomic_store(&m_sinks, std::shared_ptr<const LogSinkList>(sinks));
+    return sinkId;
+}
+
+void LogFile::removeSink(int32_t sinkId) {
+    std::shared_ptr<LogSinkChannel> channel;
+    {
+        std::lock_guard<std::mutex> lock(m_logMutex);
+        if (!LogFile::m_isInit) {
+            fprintf(stderr, "%s [ERROR] %s-%d LogFile not init\n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__);
+            return;
+        }
+        std::shared_ptr<LogSinkList> sinks(new LogSinkList(*std::atomic_load(&m_sinks)));
+        for (LogSinkList::iterator it = sinks->begin(); it != sinks->end(); ++it) {
+            if ((*it)->id() == sinkId) {
+                channel = *it;
+                sinks->erase(it);
+                std::atomic_store(&m_sinks, std::shared_ptr<const LogSinkList>(sinks));
+                break;
+            }
+        }
+    }
+    // 在调用方线程等待该目标写完积压的日志，日志线程释放旧快照时不会被阻塞
+    if (channel) {
+        channel->stop();
+    }
+}
+
+void LogFile::updateConsoleSink() {
+    const LogConfig& conf = *m_writerConf;
+    bool needConsole = 0 != conf.intConf[LC_LOG_NEED_PRINT_CONSOLE];
+    size_t maxPending = (size_t)std::max(conf.intConf[LC_LOG_CONSOLE_PENDING], 1);
+    if (m_consoleSink && (!needConsole || m_consoleSink->maxPending() != maxPending)) {
+        // 终端可能正阻塞，在维护线程等旧目标写完积压的日志
+        std::shared_ptr<LogSinkChannel> channel = m_consoleSink;
+        m_consoleSink.reset();
+        postHouseTask([channel]() { channel->stop(); });
+    }
+    if (needConsole && !m_consoleSink) {
+        m_consoleSink = std::shared_ptr<LogSinkChannel>(
+            new LogSinkChannel(-1, std::shared_ptr<LogSink>(new ConsoleLogSink()),
+                               kLogSinkAllLevels, maxPending));
+    }
+}
+
+void LogFile::submitSinks() {
+    if (m_consoleSink) {
+        m_consoleSink->submit();
+    }
+    if (m_writerSinks) {
+        for (size_t i = 0; i < m_writerSinks->size(); ++i) {
+            (*m_writerSinks)[i]->submit();
+        }
+    }
+}
+
+void LogFile::notifyWriter() {
+    // 日志线程没有休眠时不需要加锁通知
+    if (!m_writerSleeping.load()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_wakeMutex);
+    m_wakeCond.notify_one();
+}
+
+bool LogFile::canRecviveLog(int32_t level) {
     if (!LogFile::m_isInit) {
         fprintf(stderr, "%s [ERROR] %s-%d LogFile not init\n",
                 Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__);
-        return;
+        return false;
     }
 
     if (m_stopThreadFlag) {
+        return false;
+    }
+
+    return isLevelEnabled(level);
+}
+
+void LogFile::recviveOneLog(LogLevel level, const char* levelStr, const char* fileName,
+                            const char* format, ...) {
+    ProducerScope scope;
+    if (!canRecviveLog(level) || !scope.entered()) {
+        return;
+    }
+    const std::shared_ptr<const LogConfig>& conf = currentConf();
+    if (!conf) {
         return;
     }
+    int32_t rowLen = conf->intConf[LC_LOG_ROW_LENGTH];
+    if (rowLen <= 0) {
+        return;
+    }
+
+    // 时间 + 前缀 + 正文全部在线程私有缓冲区中一次写完，只有入队需要同步
+    size_t cap = kSystemTimeMaxLen + (size_t)rowLen - 1;
+    if (tlsLogBuffer.size() < cap + 1) {
+        tlsLogBuffer.resize(cap + 1);
+    }
+    char* buf = &tlsLogBuffer[0];
+    size_t len = formatLogHead(buf, cap, *conf, levelStr, fileName);
 
-    int32_t curLevel = m_logConfIntMap[LC_LOG_LEVEL];
-    if (LL_LOG_NONE == curLevel || level < curLevel) {
+    va_list args;
+    va_start(args, format);
+    int ret = vsnprintf(buf + len, cap + 1 - len, format, args);
+    va_end(args);
+    if (ret > 0) {
+        len = std::min(len + (size_t)ret, cap);
+    }
+
+    pushLog(level, len, [level, buf, len](LogRecord& record) {
+        record.level = level;
+        record.data.assign(buf, len);
+        record.deferredInfo = nullptr;
+        record.deferredFormat = nullptr;
+    });
+}
+
+void LogFile::recviveStreamLog(LogLevel level, const char* levelStr, const char* fileName,
+                               const char* function, int32_t line, const char* msg,
+                               size_t msgLen) {
+    ProducerScope scope;
+    if (!canRecviveLog(level) || !scope.entered()) {
+        return;
+    }
+    const std::shared_ptr<const LogConfig>& conf = currentConf();
+    if (!conf) {
         return;
     }
+    int32_t rowLen = conf->intConf[LC_LOG_ROW_LENGTH];
+    if (rowLen <= 0) {
+        return;
+    }
+
+    // 日志头写入线程私有缓冲区，正文在入队时从调用方的LogStream直接拷贝到队列中
+    size_t cap = kSystemTimeMaxLen + (size_t)rowLen - 1;
+    if (tlsLogBuffer.size() < cap + 1) {
+        tlsLogBuffer.resize(cap + 1);
+    }
+    char* buf = &tlsLogBuffer[0];
+    size_t len = formatLogHead(buf, cap, *conf, levelStr, fileName);
+    len = appendToBuffer(buf, len, cap, "-", 1);
+    len = appendToBuffer(buf, len, cap, function, strlen(function));
+    char lineStr[kLogStreamNumberMaxLen] = {':'};
+    size_t lineLen = 1 + formatLogDecimal(lineStr + 1, (uint64_t)std::max(line, 0));
+    lineStr[lineLen++] = ']';
+    lineStr[lineLen++] = ' ';
+    len = appendToBuffer(buf, len, cap, lineStr, lineLen);
+    msgLen = std::min(msgLen, cap - len);
+
+    pushLog(level, len + msgLen, [level, buf, len, msg, msgLen](LogRecord& record) {
+        record.level = level;
+        record.data.reserve(len + msgLen);
+        record.data.assign(buf, len);
+        record.data.append(msg, msgLen);
+        record.deferredInfo = nullptr;
+        record.deferredFormat = nullptr;
+    });
+}
+
+size_t LogFile::formatLogHead(char* buf, size_t cap, const LogConfig& conf, const char* levelStr,
+                              const char* fileName) {
     const char* finalfileName = strrchr(fileName, '/');
     if (finalfileName) {
         finalfileName++;
     } else {
         finalfileName = fileName;
     }
-    int32_t rowLen = m_logConfIntMap[LC_LOG_ROW_LENGTH];
-    if (rowLen <= 0) {
-        return;
+    const std::string& logPrefix = conf.logPrefix;
+    size_t len = Utils::formatSystemTime(buf, kSystemTimeMaxLen, conf.intConf[LC_LOG_TIME_FORMAT]);
+    len = appendToBuffer(buf, len, cap, logPrefix.c_str(), logPrefix.size());
+    len = appendToBuffer(buf, len, cap, levelStr, strlen(levelStr));
+    len = appendToBuffer(buf, len, cap, " [", 2);
+    len = appendToBuffer(buf, len, cap, finalfileName, strlen(finalfileName));
+    return len;
+}
+
+bool LogFile::reserveQueueBytes(int32_t level, size_t bytes) {
+    const std::shared_ptr<const LogConfig>& confPtr = currentConf();
+    if (!confPtr) {
+        return false;
     }
+    const LogConfig& conf = *confPtr;
+    int32_t policy = conf.intConf[LC_LOG_OVERFLOW_POLICY];
+    int64_t maxBytes = std::max(conf.intConf[LC_LOG_MAX_QUEUE_BYTES], 0);
 
-    std::string appName = m_logConfStrMap[LC_LOG_APP_NAME];
-    snprintf(m_logBuffer, rowLen, " %s [%d:%p] ", appName.c_str(), (int32_t)getpid(), (void*)this);
-    int32_t len = strlen(m_logBuffer);
-    snprintf((char*)(m_logBuffer + len), rowLen - len, "%s [%s", levelStr, finalfileName);
-    len = strlen(m_logBuffer);
+    // 超过水位后只保留WARN/ERROR
+    if (LOP_DROP_BY_LEVEL == policy && level < LL_LOG_WARN) {
+        int64_t watermark = std::min(std::max(conf.intConf[LC_LOG_SHED_WATERMARK], 0), 100);
+        if ((int64_t)m_allLogs->size() * 100 >= (int64_t)m_allLogs->limit() * watermark ||
+            (maxBytes > 0 &&
+             m_queueBytes.load(std::memory_order_relaxed) * 100 >= maxBytes * watermark)) {
+            m_droppedLogs.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
 
-    va_list args;
-    va_start(args, format);
-    vsnprintf((char*)(m_logBuffer + len), rowLen - len, format, args);
-    va_end(args);
-    len = strlen(m_logBuffer);
+    uint32_t startStamp = Utils::getTickCount();
+    while (true) {
+        int64_t used = m_queueBytes.fetch_add(bytes, std::memory_order_relaxed);
+        if (0 == maxBytes || used + (int64_t)bytes <= maxBytes) {
+            return true;
+        }
+        m_queueBytes.fetch_sub(bytes, std::memory_order_relaxed);
+        if (!waitForSpace(startStamp)) {
+            m_droppedLogs.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+}
+
+bool LogFile::waitForSpace(uint32_t startStamp) {
+    const std::shared_ptr<const LogConfig>& confPtr = currentConf();
+    if (!confPtr) {
+        return false;
+    }
+    const LogConfig& conf = *confPtr;
+    int32_t policy = conf.intConf[LC_LOG_OVERFLOW_POLICY];
+    if (LOP_BLOCK != policy && LOP_DROP_OLDEST != policy) {
+        return false;
+    }
+    uint32_t timeout = (uint32_t)std::max(conf.intConf[LC_LOG_BLOCK_TIMEOUT], 0);
+    uint32_t elapsed = Utils::getTickCount() - startStamp;
+    if (elapsed >= timeout || m_stopThreadFlag) {
+        return false;
+    }
+    if (LOP_DROP_OLDEST == policy) {
+        m_evictRequests.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::unique_lock<std::mutex> lock(m_spaceMutex);
+    m_spaceWaiters.fetch_add(1);
+    notifyWriter();
+    m_spaceCond.wait_for(lock, std::chrono::milliseconds(timeout - elapsed));
+    m_spaceWaiters.fetch_sub(1);
+    // DeInit会唤醒所有等待者，退出时不再访问队列和配置
+    return LogFile::m_isInit && !m_stopThreadFlag;
+}
 
-    const std::string finalLog = Utils::getCurrentSystemTime() + std::string(m_logBuffer, len);
-    if (m_allLogs.size() > m_logConfIntMap[LC_LOG_MAX_CONCURRENT_CNT]) {
-        fprintf(stderr, "%s [ERROR] %s-%d too much logs(%u)\n",
-                Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, m_allLogs.size());
+void LogFile::notifyProducers() {
+    if (0 == m_spaceWaiters.load()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_spaceMutex);
+    m_spaceCond.notify_all();
+}
+
+void LogFile::appendDroppedSummary() {
+    // 压力缓解后(队列使用低于一半)再输出一条汇总，避免丢日志时额外写终端
+    if (0 == m_droppedLogs.load(std::memory_order_relaxed) ||
+        m_allLogs->size() * 2 > m_allLogs->limit()) {
+        return;
+    }
+    uint64_t dropped = m_droppedLogs.exchange(0);
+    if (0 == dropped) {
         return;
     }
-    m_allLogs.push_back(finalLog);
+    const LogConfig& conf = *m_writerConf;
+    char buf[kSystemTimeMaxLen + 256];
+    size_t len = Utils::formatSystemTime(buf, kSystemTimeMaxLen, conf.intConf[LC_LOG_TIME_FORMAT]);
+    const char* fileName = strrchr(__FILE__, '/');
+    fileName = fileName ? fileName + 1 : __FILE__;
+    int ret = snprintf(buf + len, sizeof(buf) - len, "%sW [%s-%s:%d] dropped %llu logs by overflow",
+                       conf.logPrefix.c_str(), fileName, __FUNCTION__, __LINE__,
+                       (unsigned long long)dropped);
+    if (ret > 0) {
+        len = std::min(len + (size_t)ret, sizeof(buf) - 1);
+    }
+    appendOneLog(LL_LOG_WARN, std::string(buf, len));
 }
 
-bool LogFile::writeOneLog(const std::string& log) {
+void LogFile::appendOneLog(int32_t level, const std::string& log) {
     if (log.size() <= 0) {
-        return false;
+        return;
+    }
+    const LogConfig& conf = *m_writerConf;
+    // 其他输出目标只在这里追加到各自的批次，由各自的线程输出
+    if (m_consoleSink) {
+        m_consoleSink->append(level, log.data(), log.size());
+    }
+    if (m_writerSinks) {
+        for (size_t i = 0; i < m_writerSinks->size(); ++i) {
+            const std::shared_ptr<LogSinkChannel>& sink = (*m_writerSinks)[i];
+            if (sink->accept(level)) {
+                sink->append(level, log.data(), log.size());
+            }
+        }
     }
-    if (0 != getIntConf(LC_LOG_NEED_PRINT_CONSOLE)) {
-        fprintf(stdout, "%s\n", log.c_str());
+
+    // 加密的日志按帧组织，整批在flushLogs中一次加密，加密方式变化时先写完当前批次
+    int32_t encryptType = conf.intConf[LC_LOG_NEED_ENCRYPTION];
+    if (!m_writeBuffer.empty() && encryptType != m_batchEncType) {
+        flushLogs();
+    }
+    bool framed = ET_NO_ENCRYPTION != encryptType;
+    size_t recordLen = framed ? kLogFrameLenSize + log.size() : log.size() + 1;
+    if (framed && m_writeBuffer.empty()) {
+        recordLen += kLogFrameHeaderLen;
     }
 
+    // 当前文件放不下这一行时，先把缓冲区写入当前文件再滚动
+    uint64_t pending = m_curFileSize + m_writeBuffer.size();
+    uint64_t maxFileSize = (uint64_t)std::max(conf.intConf[LC_LOG_FILE_MAX_SIEZ], 0);
+    if (pending > 0 && pending + recordLen > maxFileSize) {
+        flushLogs();
+        rotateFile();
+    }
+    if (m_writeBuffer.empty()) {
+        m_batchEncType = encryptType;
+        m_batchRecordCnt = 0;
+        if (framed) {
+            // 预留帧头，写文件前再填充
+            m_writeBuffer.resize(kLogFrameHeaderLen);
+        }
+    }
+    if (framed) {
+        char lenBuf[kLogFrameLenSize];
+        putLogFrameU32(lenBuf, (uint32_t)log.size());
+        m_writeBuffer.append(lenBuf, kLogFrameLenSize).append(log);
+    } else {
+        m_writeBuffer.append(log).push_back('\n');
+    }
+    ++m_batchRecordCnt;
+
+    if (level >= LL_LOG_ERROR && 0 != conf.intConf[LC_LOG_FLUSH_ON_ERROR]) {
+        m_needFlush = true;
+    }
+    if (m_writeBuffer.size() >= (size_t)std::max(conf.intConf[LC_LOG_FLUSH_BYTES], 0)) {
+        flushLogs();
+    }
+}
+
+bool LogFile::flushLogs() {
+    m_needFlush = false;
+    m_lastFlushStamp = Utils::getTickCount();
+    if (m_writeBuffer.empty()) {
+        return true;
+    }
+    // 写入方式变化时先关闭文件，重新打开时切换
+    const LogConfig& conf = *m_writerConf;
+    if (m_logFd >= 0 && (m_writerMode != conf.intConf[LC_LOG_WRITER_MODE] ||
+                         m_writerDirectIo != conf.intConf[LC_LOG_DIRECT_IO])) {
+        closeFile();
+    }
     if (!openFile()) {
+        m_writeBuffer.clear();
         return false;
     }
 
-    std::string encryptLog = log;
-    int32_t encryptType = getIntConf(LC_LOG_NEED_ENCRYPTION);
+    if (ET_NO_ENCRYPTION != m_batchEncType) {
+        sealBatch();
+    }
+    // 异步后端只拷贝到自己的缓冲区后提交，m_writeBuffer可以立即开始攒下一批
+    bool ret = m_writer->write(m_writeBuffer.data(), m_writeBuffer.size());
+    m_curFileSize = m_writer->offset();
+    m_writeBuffer.clear();
+    return ret;
+}
 
+void LogFile::sealBatch() {
+    LogFrameHeader header;
+    header.version = kLogFrameVersion;
+    header.encType = (uint8_t)m_batchEncType;
+    header.payloadLen = (uint32_t)(m_writeBuffer.size() - kLogFrameHeaderLen);
+    header.recordCnt = m_batchRecordCnt;
+    // 每批的IV：随机数 + 批次序号，序号放在高32位，保证不同批次的CTR计数器不会重叠
+    uint64_t counter = (++m_batchSeq) << 32;
+    memcpy(header.iv, &m_ivSeed, sizeof(m_ivSeed));
+    memcpy(header.iv + sizeof(m_ivSeed), &counter, sizeof(counter));
+
+    unsigned char* payload = (unsigned char*)&m_writeBuffer[kLogFrameHeaderLen];
     {
         std::lock_guard<std::mutex> lock(m_logMutex);
-        if (ET_NO_ENCRYPTION != encryptType &&
-            m_encryptTools.find(encryptType) != m_encryptTools.end()) {
-            unsigned char* encryptData = new unsigned char[log.size()];
-            int totalLen = log.size();
-            m_encryptTools[encryptType]
-                ->encrypt(encryptData, (const unsigned char*)log.c_str(), totalLen);
-            encryptLog = std::string((const char*)encryptData, totalLen);
+        std::map<int32_t, std::shared_ptr<baseEncrypt>>::iterator it =
+            m_encryptTools.find(m_batchEncType);
+        if (it != m_encryptTools.end()) {
+            it->second->cryptStream(payload, payload, header.payloadLen, header.iv, 0);
+        } else {
+            // 不支持的加密方式，保留帧格式但不加密
+            header.encType = ET_NO_ENCRYPTION;
         }
     }
-    if (m_logFd != nullptr && fprintf(m_logFd, "%s\n", encryptLog.c_str()) < 0) {
-        return false;
+    encodeLogFrameHeader(&m_writeBuffer[0], header);
+}
+
+void LogFile::formatDeferredLog(const LogRecord& record, std::string& out) {
+    const DeferredLogInfo* info = record.deferredInfo;
+    const char* finalfileName = strrchr(info->fileName, '/');
+    finalfileName = finalfileName ? finalfileName + 1 : info->fileName;
+    const LogConfig& conf = *m_writerConf;
+    int32_t rowLen = std::max(conf.intConf[LC_LOG_ROW_LENGTH], 1);
+    const std::string& logPrefix = conf.logPrefix;
+
+    // 与recviveOneLog的输出格式保持一致
+    size_t cap = kSystemTimeMaxLen + (size_t)rowLen - 1;
+    out.resize(cap + 1);
+    char* buf = &out[0];
+    size_t len =
+        Utils::formatTime(record.stamp, buf, kSystemTimeMaxLen, conf.intConf[LC_LOG_TIME_FORMAT]);
+    len = appendToBuffer(buf, len, cap, logPrefix.c_str(), logPrefix.size());
+    len = appendToBuffer(buf, len, cap, info->levelStr, strlen(info->levelStr));
+    len = appendToBuffer(buf, len, cap, " [", 2);
+    len = appendToBuffer(buf, len, cap, finalfileName, strlen(finalfileName));
+    int ret = snprintf(buf + len, cap + 1 - len, "-%s:%d] ", info->function, info->line);
+    if (ret > 0) {
+        len = std::min(len + (size_t)ret, cap);
     }
-    fflush(m_logFd);
-    return true;
+    ret = record.deferredFormat(buf + len, cap + 1 - len, info->format, record.data.c_str());
+    if (ret > 0) {
+        len = std::min(len + (size_t)ret, cap);
+    }
+    out.resize(len);
 }
 
-void LogFile::threadFunc() {
-    while (!m_stopThreadFlag) {
-        std::deque<std::string> tmpQueue;
-        {
-            std::lock_guard<std::mutex> lock(m_logMutex);
-            tmpQueue.swap(m_allLogs);
-        }
-        while (!tmpQueue.empty()) {
-            const std::string log = tmpQueue.front();
-            tmpQueue.pop_front();
-            if (!writeOneLog(log)) {
-                break;
+size_t LogFile::drainLogs() {
+    // 每轮最多处理一批，持续写入时也能及时回到主循环刷新配置、打包和提交输出目标
+    size_t cnt = m_allLogs->consume(
+        [this](LogRecord& record) {
+            m_queueBytes.fetch_sub(record.data.size(), std::memory_order_relaxed);
+            // LOP_DROP_OLDEST：丢弃最早的日志，为等待中的生产者腾出空间
+            uint32_t evict = m_evictRequests.load(std::memory_order_relaxed);
+            if (evict > 0 && m_spaceWaiters.load(std::memory_order_relaxed) > 0 &&
+                m_evictRequests.compare_exchange_strong(evict, evict - 1)) {
+                m_droppedLogs.fetch_add(1, std::memory_order_relaxed);
+                return;
             }
-        }
-        compressLogs();
+            if (record.deferredFormat) {
+                formatDeferredLog(record, m_deferredBuffer);
+                appendOneLog(record.level, m_deferredBuffer);
+            } else {
+                appendOneLog(record.level, record.data);
+            }
+        },
+        kLogDrainBatchCnt);
+    notifyProducers();
+    if (0 == m_spaceWaiters.load(std::memory_order_relaxed)) {
+        m_evictRequests.store(0, std::memory_order_relaxed);
     }
+    appendDroppedSummary();
+    submitSinks();
 
-    std::deque<std::string> tmpQueue;
+    // 没有攒够flush字节数时，按错误日志或者刷盘间隔决定是否写入
+    if (m_writeBuffer.empty()) {
+        return cnt;
+    }
+    uint32_t flushInterval = (uint32_t)std::max(m_writerConf->intConf[LC_LOG_FLUSH_INTERVAL], 0);
+    if (m_needFlush ||
+        Utils::isEqualOrBiggerUint32(Utils::getTickCount(), m_lastFlushStamp + flushInterval)) {
+        flushLogs();
+    }
+    return cnt;
+}
+
+void LogFile::waitForLogs() {
+    // 有未写入的数据时最多等到刷盘间隔，保证最大落盘延迟
+    uint32_t waitMs = kLogWriterIdleWaitMs;
+    if (!m_writeBuffer.empty()) {
+        uint32_t flushInterval =
+            (uint32_t)std::max(m_writerConf->intConf[LC_LOG_FLUSH_INTERVAL], 0);
+        uint32_t elapsed = Utils::getTickCount() - m_lastFlushStamp;
+        waitMs = elapsed < flushInterval ? flushInterval - elapsed : 0;
+    }
+    if (waitMs == 0) {
+        return;
+    }
     {
-        std::lock_guard<std::mutex> lock(m_logMutex);
-        tmpQueue.swap(m_allLogs);
+        std::lock_guard<std::mutex> lock(m_zipMutex);
+        if (!m_zipCallBacks.empty()) {
+            return;
+        }
     }
-    while (!tmpQueue.empty()) {
-        const std::string log = tmpQueue.front();
-        tmpQueue.pop_front();
-        if (!writeOneLog(log)) {
-            break;
+
+    std::unique_lock<std::mutex> lock(m_wakeMutex);
+    // seq_cst，先声明休眠再检查队列，与生产者的入队、读取休眠标记配对
+    m_writerSleeping.store(true);
+    if (m_allLogs->size() == 0 && !m_stopThreadFlag) {
+        if (std::cv_status::no_timeout ==
+            m_wakeCond.wait_for(lock, std::chrono::milliseconds(waitMs))) {
+            m_writerWakeups.fetch_add(1, std::memory_order_relaxed);
         }
     }
+    m_writerSleeping.store(false);
+}
+
+void LogFile::threadFunc() {
+    std::chrono::steady_clock::time_point busyStart = std::chrono::steady_clock::now();
+    while (!m_stopThreadFlag) {
+        m_writerConf = currentConf();
+        m_writerSinks = std::atomic_load(&m_sinks);
+        updateConsoleSink();
+        drainLogs();
+        compressLogs();
+
+        std::chrono::steady_clock::time_point idleStart = std::chrono::steady_clock::now();
+        waitForLogs();
+        std::chrono::steady_clock::time_point idleEnd = std::chrono::steady_clock::now();
+        m_writerBusyUs.fetch_add(
+            std::chrono::duration_cast<std::chrono::microseconds>(idleStart - busyStart).count(),
+            std::memory_order_relaxed);
+        m_writerIdleUs.fetch_add(
+            std::chrono::duration_cast<std::chrono::microseconds>(idleEnd - idleStart).count(),
+            std::memory_order_relaxed);
+        busyStart = idleEnd;
+    }
+    m_writerConf = currentConf();
+    m_writerSinks = std::atomic_load(&m_sinks);
+    updateConsoleSink();
+    while (drainLogs() > 0) {
+    }
+    flushLogs();
+}
+
+void LogFile::updateLogFiles(const LogConfig& conf) {
+    std::string logDir = conf.strConf[LC_LOG_OUTPUT_PATH] + "/" + conf.strConf[LC_LOG_FILE_NAME];
+    bool needWatch = 0 != conf.intConf[LC_LOG_WATCH_DIR];
+    if (logDir != m_indexedLogDir || needWatch != (m_dirWatchFd >= 0)) {
+        rebuildLogFiles(conf, logDir);
+        return;
+    }
+    syncLogFiles(conf);
 }
 
-void LogFile::updateLogFiles() {
+void LogFile::rebuildLogFiles(const LogConfig& conf, const std::string& logDir) {
+    const std::string& path = conf.strConf[LC_LOG_OUTPUT_PATH];
+    const std::string& fileName = conf.strConf[LC_LOG_FILE_NAME];
+    closeDirWatch();
+    m_allFiles.clear();
+    m_indexedLogDir = logDir;
+    // 先建立监听再扫描，扫描期间的变化会在下次syncLogFiles时补上
+    if (0 != conf.intConf[LC_LOG_WATCH_DIR]) {
+        m_dirWatchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_dirWatchFd >= 0 &&
+            inotify_add_watch(m_dirWatchFd, path.c_str(),
+                              IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+            fprintf(stderr, "%s [ERROR] %s-%d watch %s failed, errno %d\n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, path.c_str(),
+                    errno);
+            closeDirWatch();
+        }
+    }
+
     std::vector<std::string> files;
-    std::string fileName = getStrConf(LC_LOG_FILE_NAME);
-    Utils::getDirFiles(getStrConf(LC_LOG_OUTPUT_PATH), files);
+    Utils::getDirFiles(path, files, fileName + "_");
     for (std::vector<std::string>::iterator it = files.begin(); it != files.end(); it++) {
-        std::string logFileName = (*it);
-        if (logFileName.find(fileName) == std::string::npos) {
+        uint32_t stamp = 0;
+        if (!parseLogFileStamp(*it, fileName, stamp)) {
             continue;
         }
-        if ((logFileName + ".log") == fileName) {
+        std::map<uint32_t, std::string>::iterator exist = m_allFiles.find(stamp);
+        if (exist == m_allFiles.end()) {
+            m_allFiles[stamp] = *it;
             continue;
         }
-        // test_2020-10-01_1245.log
-        std::size_t pos = logFileName.find(".log");
-        if (pos == std::string::npos) {
-            continue;
+        // 压缩文件是写完后才改名的，与原文件同时存在说明上次删除原文件前退出了
+        bool packed = hasSuffix(*it, kLogPackSuffix);
+        const std::string& rawFile = packed ? exist->second : *it;
+        const std::string& packFile = packed ? *it : exist->second;
+        if (rawFile + kLogPackSuffix == packFile) {
+            unlink((path + "/" + rawFile).c_str());
+            exist->second = packFile;
         }
-        std::string name = logFileName.substr(0, pos);
-        std::vector<std::string> subInfos;
-        Utils::split(name, "_", subInfos);
-        if (subInfos.size() != 3 || !Utils::isDigit(subInfos[2])) {
-            continue;
+    }
+    // 上次退出时还没来得及压缩的文件
+    if (0 != conf.intConf[LC_LOG_COMPRESS_ON_ROTATE]) {
+        std::shared_ptr<const LogConfig> confPtr(new LogConfig(conf));
+        for (std::map<uint32_t, std::string>::iterator it = m_allFiles.begin();
+             it != m_allFiles.end(); ++it) {
+            if (!hasSuffix(it->second, kLogPackSuffix)) {
+                postPackTask(confPtr, it->first, it->second);
+            }
         }
-        { m_allFiles[std::stoul(subInfos[2])] = logFileName; }
     }
 }
 
-void LogFile::cleanOldFiles() {
-    if (0 == getIntConf(LC_LOG_NEED_REGULAR_CLEAN)) {
+void LogFile::syncLogFiles(const LogConfig& conf) {
+    if (m_dirWatchFd < 0) {
         return;
     }
-    int maxFilesNum = std::max(getIntConf(LC_LOG_FILE_MAX_NUM), 1);
-    std::string path = getStrConf(LC_LOG_OUTPUT_PATH);
+    const std::string& fileName = conf.strConf[LC_LOG_FILE_NAME];
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        ssize_t len = read(m_dirWatchFd, buf, sizeof(buf));
+        if (len <= 0) {
+            break;
+        }
+        for (char* ptr = buf; ptr < buf + len;) {
+            const struct inotify_event* event = (const struct inotify_event*)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                // 事件丢失，只能重新扫描
+                rebuildLogFiles(conf, m_indexedLogDir);
+                return;
+            }
+            uint32_t stamp = 0;
+            if (event->len == 0 || !parseLogFileStamp(event->name, fileName, stamp)) {
+                continue;
+            }
+            std::map<uint32_t, std::string>::iterator it = m_allFiles.find(stamp);
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                m_allFiles[stamp] = event->name;
+            } else if (it != m_allFiles.end() && it->second == event->name) {
+                // 压缩完成后删除原文件时，索引中已经是压缩文件
+                m_allFiles.erase(it);
+            }
+        }
+    }
+}
+
+void LogFile::closeDirWatch() {
+    if (m_dirWatchFd >= 0) {
+        close(m_dirWatchFd);
+        m_dirWatchFd = -1;
+    }
+}
+
+void LogFile::cleanOldFiles(const LogConfig& conf) {
+    if (0 == conf.intConf[LC_LOG_NEED_REGULAR_CLEAN]) {
+        return;
+    }
+    int maxFilesNum = std::max(conf.intConf[LC_LOG_FILE_MAX_NUM], 1);
+    const std::string& path = conf.strConf[LC_LOG_OUTPUT_PATH];
 
     while (m_allFiles.size() > maxFilesNum - 1) {
         std::map<uint32_t, std::string>::iterator it = m_allFiles.begin();
@@ -375,46 +1171,400 @@ void LogFile::cleanOldFiles() {
         }
         m_allFiles.erase(m_allFiles.begin());
     }
+
+    // 按实际占用的磁盘大小清理，压缩过的文件按压缩后的大小计算，
+    // 开启滚动后压缩时还未压缩的文件不计入，等压缩完成后再清理
+    int64_t maxBytes = conf.intConf[LC_LOG_FILES_MAX_BYTES];
+    if (maxBytes <= 0) {
+        return;
+    }
+    bool packOnRotate = 0 != conf.intConf[LC_LOG_COMPRESS_ON_ROTATE];
+    int64_t totalBytes = 0;
+    std::vector<std::pair<uint32_t, int64_t>> sizes;
+    for (std::map<uint32_t, std::string>::iterator it = m_allFiles.begin();
+         it != m_allFiles.end(); ++it) {
+        if (packOnRotate && !hasSuffix(it->second, kLogPackSuffix)) {
+            continue;
+        }
+        struct stat st;
+        int64_t size = (0 == stat((path + "/" + it->second).c_str(), &st)) ? st.st_size : 0;
+        sizes.push_back(std::make_pair(it->first, size));
+        totalBytes += size;
+    }
+    for (size_t i = 0; i < sizes.size() && totalBytes > maxBytes; ++i) {
+        std::string fileName = path + "/" + m_allFiles[sizes[i].first];
+        if (unlink(fileName.c_str()) < 0 && errno != ENOENT) {
+            fprintf(stderr, "%s [ERROR] %s-%d unlink %s failed \n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__,
+                    fileName.c_str());
+        }
+        m_allFiles.erase(sizes[i].first);
+        totalBytes -= sizes[i].second;
+    }
 }
 
 bool LogFile::openFile() {
-    std::string outputLogPath = getStrConf(LC_LOG_OUTPUT_PATH);
-    std::string logFileName = getStrConf(LC_LOG_FILE_NAME);
-    int32_t logFileMaxSize = getIntConf(LC_LOG_FILE_MAX_SIEZ);
+    if (m_logFd >= 0) {
+        return true;
+    }
+    std::shared_ptr<const LogConfig> conf = m_writerConf;
+    const std::string& outputLogPath = conf->strConf[LC_LOG_OUTPUT_PATH];
+    const std::string& logFileName = conf->strConf[LC_LOG_FILE_NAME];
 
+    // 只在打开文件时检查目录，写日志时不再逐行access
     if (0 != access(outputLogPath.c_str(), F_OK) && !Utils::mkdirRecursive(outputLogPath)) {
         return false;
     }
 
     const std::string logFile = outputLogPath + "/" + logFileName + ".log";
-    if (!m_logFd) {
-        updateLogFiles();
-        cleanOldFiles();
-        m_logFd = fopen(logFile.c_str(), "a+");
-    }
-
-    long ftellRes = ftell(m_logFd);
-    if (ftellRes < 0 || ftellRes > logFileMaxSize) {
-        fclose(m_logFd);
-        m_logFd = nullptr;
-        // test_2020-10-01_1245.log
-        uint32_t stamp = Utils::getTickCount();
-        std::string stampFile = logFileName + "_" + Utils::getCurrentSystemDate() + "_" +
-                                std::to_string(stamp) + ".log";
-        std::string newFileName = outputLogPath + "/" + stampFile;
+    // 使用O_RDWR，O_DIRECT续写时需要读回最后一个不完整的块
+    int fd = open(logFile.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "%s [ERROR] %s-%d open %s failed, errno %d\n",
+                Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, logFile.c_str(),
+                errno);
+        return false;
+    }
+    postHouseTask([this, conf]() {
+        updateLogFiles(*conf);
+        cleanOldFiles(*conf);
+        prepareSpareFile(conf);
+    });
+    return attachFile(fd, logFile);
+}
+
+bool LogFile::attachFile(int fd, const std::string& logFile) {
+    const LogConfig& conf = *m_writerConf;
+    m_logFd = fd;
+    // 文件大小在内存中维护，之后不再ftell
+    struct stat fileStat;
+    m_curFileSize = (0 == fstat(m_logFd, &fileStat)) ? (uint64_t)fileStat.st_size : 0;
+
+    // 写入方式只在文件关闭期间切换
+    if (!m_writer || m_writerMode != conf.intConf[LC_LOG_WRITER_MODE] ||
+        m_writerDirectIo != conf.intConf[LC_LOG_DIRECT_IO]) {
+        m_writerMode = conf.intConf[LC_LOG_WRITER_MODE];
+        m_writerDirectIo = conf.intConf[LC_LOG_DIRECT_IO];
+        m_writer = LogWriter::create(m_writerMode, m_writerDirectIo != 0);
+    }
+    uint64_t maxFileSize = (uint64_t)std::max(conf.intConf[LC_LOG_FILE_MAX_SIEZ], 0);
+    if (!m_writer->attach(m_logFd, m_curFileSize, maxFileSize)) {
+        fprintf(stderr, "%s [ERROR] %s-%d attach %s failed, errno %d\n",
+                Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, logFile.c_str(),
+                errno);
+        close(m_logFd);
+        m_logFd = -1;
+        return false;
+    }
+    // mmap写入时文件可能带有上次异常退出遗留的预分配空间，以后端修正后的大小为准
+    m_curFileSize = m_writer->offset();
+    return true;
+}
+
+void LogFile::closeFile() {
+    if (m_logFd < 0) {
+        return;
+    }
+    // 等待异步写完成后才能关闭文件
+    m_writer->detach();
+    close(m_logFd);
+    m_logFd = -1;
+}
+
+void LogFile::rotateFile() {
+    std::shared_ptr<const LogConfig> conf = m_writerConf;
+    const std::string& outputLogPath = conf->strConf[LC_LOG_OUTPUT_PATH];
+    const std::string& logFileName = conf->strConf[LC_LOG_FILE_NAME];
+
+    closeFile();
+    m_curFileSize = 0;
+    const std::string logFile = outputLogPath + "/" + logFileName + ".log";
+    // 滚动不再等待维护线程，同一毫秒内可能滚动多次，时间戳递增保证文件名不重复
+    uint32_t stamp = Utils::getTickCount();
+    if (!Utils::isBiggerUint32(stamp, m_lastRotateStamp)) {
+        stamp = m_lastRotateStamp + 1;
+    }
+    m_lastRotateStamp = stamp;
+    std::string stampFile = buildStampFileName(logFileName, stamp);
+
+    // 直接切换到预先创建好的文件，改名和清理交给维护线程
+    std::string sparePath = getSparePath(*conf);
+    int spareFd = takeSpareFile(sparePath);
+    if (spareFd < 0) {
+        // 连续滚动时下一个文件可能还没准备好，不等维护线程，直接按序号创建一个新文件，
+        // 同样由维护线程在改名时换成logFile；同一毫秒内可能多次滚动，不能用时间戳命名
+        std::string freshPath;
+        for (int32_t i = 0; spareFd < 0 && i < kLogFreshFileTries; ++i) {
+            freshPath = sparePath + "." + std::to_string(m_freshFileSeq++);
+            // 先登记再创建，维护线程不会把它当作上次遗留的空文件删除
+            setLiveSpare(freshPath, true);
+            spareFd = open(freshPath.c_str(), O_RDWR | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC,
+                           0644);
+            if (spareFd < 0) {
+                int err = errno;
+                setLiveSpare(freshPath, false);
+                if (err != EEXIST) {
+                    break;
+                }
+            }
+        }
+        if (spareFd < 0) {
+            fprintf(stderr, "%s [ERROR] %s-%d open %s failed, errno %d\n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__,
+                    freshPath.c_str(), errno);
+        }
+        sparePath = freshPath;
+    }
+    bool useSpare = spareFd >= 0;
+    postHouseTask([this, conf, logFile, stampFile, stamp, sparePath, useSpare]() {
+        updateLogFiles(*conf);
+        std::string newFileName = conf->strConf[LC_LOG_OUTPUT_PATH] + "/" + stampFile;
         if (rename(logFile.c_str(), newFileName.c_str()) < 0) {
             fprintf(stderr, "%s [ERROR] %s-%d  rename files name %s failed \n",
                     Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__,
                     newFileName.c_str());
+        } else {
+            m_allFiles[stamp] = stampFile;
+            postPackTask(conf, stamp, stampFile);
+        }
+        if (useSpare && rename(sparePath.c_str(), logFile.c_str()) < 0) {
+            fprintf(stderr, "%s [ERROR] %s-%d  rename files name %s failed \n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__,
+                    logFile.c_str());
+        }
+        if (useSpare) {
+            setLiveSpare(sparePath, false);
+        }
+        cleanOldFiles(*conf);
+        prepareSpareFile(conf);
+    });
+    // 创建失败时下次写入再由openFile打开
+    if (useSpare) {
+        attachFile(spareFd, logFile);
+    }
+}
+
+std::string LogFile::getSparePath(const LogConfig& conf) {
+    return conf.strConf[LC_LOG_OUTPUT_PATH] + "/." + conf.strConf[LC_LOG_FILE_NAME] + ".log.next";
+}
+
+void LogFile::prepareSpareFile(const std::shared_ptr<const LogConfig>& conf) {
+    std::string sparePath = getSparePath(*conf);
+    {
+        std::lock_guard<std::mutex> lock(m_houseMutex);
+        if (m_spareFd >= 0 && m_sparePath == sparePath) {
+            return;
+        }
+        // 上次准备的文件已被日志线程取走但还没改名，由那次滚动的任务改名后再准备
+        if (m_liveSpares.count(sparePath) > 0) {
+            return;
+        }
+    }
+    // 目录或文件名变化后，之前准备的文件已经用不上了
+    closeSpareFile();
+
+    // 上次异常退出时，预创建的文件(包括滚动时直接创建的)中可能已经写入了日志，作为滚动文件保留；
+    // 日志线程正在写、还没改名为logFile的文件不能动
+    const std::string& path = conf->strConf[LC_LOG_OUTPUT_PATH];
+    std::vector<std::string> files;
+    Utils::getDirFiles(path, files, "." + conf->strConf[LC_LOG_FILE_NAME] + ".log.next");
+    uint32_t stamp = Utils::getTickCount();
+    for (size_t i = 0; i < files.size(); ++i) {
+        std::string filePath = path + "/" + files[i];
+        {
+            std::lock_guard<std::mutex> lock(m_houseMutex);
+            if (m_liveSpares.count(filePath) > 0) {
+                continue;
+            }
+        }
+        struct stat fileStat;
+        if (0 != stat(filePath.c_str(), &fileStat)) {
+            continue;
+        }
+        if (0 == fileStat.st_size) {
+            if (filePath != sparePath) {
+                unlink(filePath.c_str());
+            }
+            continue;
+        }
+        std::string stampFile = buildStampFileName(conf->strConf[LC_LOG_FILE_NAME], stamp);
+        if (0 == rename(filePath.c_str(), (path + "/" + stampFile).c_str())) {
+            m_allFiles[stamp] = stampFile;
+            postPackTask(conf, stamp, stampFile);
+            ++stamp;
+        }
+    }
+    int fd = open(sparePath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "%s [ERROR] %s-%d open %s failed, errno %d\n",
+                Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, sparePath.c_str(),
+                errno);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_houseMutex);
+    m_spareFd = fd;
+    m_sparePath = sparePath;
+}
+
+int LogFile::takeSpareFile(const std::string& sparePath) {
+    std::lock_guard<std::mutex> lock(m_houseMutex);
+    if (m_spareFd < 0 || m_sparePath != sparePath) {
+        return -1;
+    }
+    int fd = m_spareFd;
+    m_spareFd = -1;
+    m_sparePath.clear();
+    m_liveSpares.insert(sparePath);
+    return fd;
+}
+
+void LogFile::setLiveSpare(const std::string& sparePath, bool live) {
+    std::lock_guard<std::mutex> lock(m_houseMutex);
+    if (live) {
+        m_liveSpares.insert(sparePath);
+    } else {
+        m_liveSpares.erase(sparePath);
+    }
+}
+
+void LogFile::closeSpareFile() {
+    int fd = -1;
+    std::string sparePath;
+    {
+        std::lock_guard<std::mutex> lock(m_houseMutex);
+        fd = m_spareFd;
+        sparePath = m_sparePath;
+        m_spareFd = -1;
+        m_sparePath.clear();
+    }
+    if (fd >= 0) {
+        close(fd);
+        unlink(sparePath.c_str());
+    }
+}
+
+void LogFile::postHouseTask(const std::function<void()>& task) {
+    {
+        std::lock_guard<std::mutex> lock(m_houseMutex);
+        m_houseTasks.push_back(task);
+    }
+    m_houseCond.notify_all();
+}
+
+void LogFile::houseKeepFunc() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_houseMutex);
+            m_houseCond.wait(lock, [this] { return m_houseStop || !m_houseTasks.empty(); });
+            if (m_houseTasks.empty()) {
+                break;
+            }
+            task = m_houseTasks.front();
+            m_houseTasks.pop_front();
+            m_houseBusy = true;
+        }
+        task();
+        {
+            std::lock_guard<std::mutex> lock(m_houseMutex);
+            m_houseBusy = false;
         }
-        openFile();
+        m_houseCond.notify_all();
     }
+    closeSpareFile();
+}
+
+void LogFile::postPackTask(const std::shared_ptr<const LogConfig>& conf, uint32_t stamp,
+                           const std::string& stampFile) {
+    if (0 == conf->intConf[LC_LOG_COMPRESS_ON_ROTATE]) {
+        return;
+    }
+    postPackTask([this, conf, stamp, stampFile]() { packRotatedFile(conf, stamp, stampFile); });
+}
+
+bool LogFile::postPackTask(const std::function<void()>& task, bool urgent) {
+    {
+        std::lock_guard<std::mutex> lock(m_packMutex);
+        if (m_packStop) {
+            return false;
+        }
+        // 打包请求有业务在等回调，不排在滚动文件的压缩之后
+        if (urgent) {
+            m_packTasks.push_front(task);
+        } else {
+            m_packTasks.push_back(task);
+        }
+    }
+    m_packCond.notify_all();
     return true;
 }
 
+void LogFile::packFunc() {
+    // 只降低本线程的优先级，压缩不和日志线程、业务线程争抢CPU
+    if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), kLogPackNice) < 0) {
+        fprintf(stderr, "%s [ERROR] %s-%d setpriority failed, errno %d\n",
+                Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, errno);
+    }
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_packMutex);
+            m_packCond.wait(lock, [this] { return m_packStop || !m_packTasks.empty(); });
+            if (m_packStop) {
+                break;
+            }
+            task = m_packTasks.front();
+            m_packTasks.pop_front();
+        }
+        task();
+    }
+}
+
+void LogFile::packRotatedFile(const std::shared_ptr<const LogConfig>& conf, uint32_t stamp,
+                              const std::string& stampFile) {
+    const std::string& path = conf->strConf[LC_LOG_OUTPUT_PATH];
+    std::string rawPath = path + "/" + stampFile;
+    std::string packFile = stampFile + kLogPackSuffix;
+    std::string packPath = path + "/" + packFile;
+    // 写完再改名，压缩文件出现时一定是完整的
+    std::string tmpPath = path + "/." + packFile + ".tmp";
+    HZIP hz = CreateZip(tmpPath.c_str(), 0);
+    if (hz != 0) {
+        ZipSetThreads(hz, getZipThreads(*conf));
+    }
+    ZRESULT res = hz != 0 ? ZipAdd(hz, stampFile.c_str(), rawPath.c_str()) : ZR_NOFILE;
+    ZRESULT closeRes = hz != 0 ? CloseZip(hz) : ZR_NOFILE;
+    if (ZR_OK != res || ZR_OK != closeRes || rename(tmpPath.c_str(), packPath.c_str()) < 0) {
+        // 原文件可能已经被清理
+        if (0 == access(rawPath.c_str(), F_OK)) {
+            fprintf(stderr, "%s [ERROR] %s-%d compress %s failed, result:%lu errno:%d \n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__,
+                    rawPath.c_str(), (unsigned long)(ZR_OK != res ? res : closeRes), errno);
+        }
+        unlink(tmpPath.c_str());
+        return;
+    }
+    postHouseTask([this, conf, stamp, rawPath, packFile, packPath]() {
+        updateLogFiles(*conf);
+        std::map<uint32_t, std::string>::iterator it = m_allFiles.find(stamp);
+        if (it == m_allFiles.end()) {
+            // 压缩期间原文件已经被清理
+            unlink(packPath.c_str());
+            return;
+        }
+        it->second = packFile;
+        if (unlink(rawPath.c_str()) < 0 && errno != ENOENT) {
+            fprintf(stderr, "%s [ERROR] %s-%d unlink %s failed \n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__,
+                    rawPath.c_str());
+        }
+        cleanOldFiles(*conf);
+    });
+}
+
 bool LogFile::enableCompress() {
     // 配置不允许压缩
-    if (getIntConf(LC_LOG_ENABLE_COMPRESS) == 0) {
+    if (m_writerConf->intConf[LC_LOG_ENABLE_COMPRESS] == 0) {
         std::lock_guard<std::mutex> lock(m_zipMutex);
         m_zipCallBacks.clear();
         return false;
@@ -427,88 +1577,221 @@ void LogFile::compressLogs() {
         return;
     }
 
+    const LogConfig& conf = *m_writerConf;
+    const std::string& path = conf.strConf[LC_LOG_OUTPUT_PATH];
+    std::string compressName = path + "/" + conf.strConf[LC_LOG_APP_NAME] + ".zip";
+    // 暂时没有到压缩间隔，此时会使用上次的压缩数据作为callback
+    uint32_t now = Utils::getTickCount();
+    uint32_t compressInterval = std::max(conf.intConf[LC_LOG_COMPRESS_INTERVAL] * 1000, 10 * 1000);
+    bool reuse = false;
     {
         std::lock_guard<std::mutex> lock(m_zipMutex);
-        if (m_zipCallBacks.size() == 0) {
+        // 没有请求，或者上一次打包还没有完成
+        if (m_zipCallBacks.size() == 0 || m_zipPending) {
             return;
         }
+        reuse = m_lastCompressStamp != 0 && m_zipCachePath == compressName &&
+                Utils::isBiggerUint32(m_lastCompressStamp + compressInterval, now);
+        m_zipPending = !reuse;
     }
-
-    std::string path = getStrConf(LC_LOG_OUTPUT_PATH);
-    std::string compressName = path + "/" + getStrConf(LC_LOG_APP_NAME) + ".zip";
-    std::string nowFileName = getStrConf(LC_LOG_FILE_NAME) + ".log";
-    std::string nowLogPath = path + "/" + nowFileName;
-    // 暂时没有到压缩间隔，此时会使用上次的压缩文件作为callback
-    uint32_t now = Utils::getTickCount();
-    uint32_t compressInterval = std::max(getIntConf(LC_LOG_COMPRESS_INTERVAL) * 1000, 10 * 1000);
-    if (m_lastCompressStamp != 0 &&
-        Utils::isBiggerUint32(m_lastCompressStamp + compressInterval, now)) {
+    if (reuse) {
         onCompressData(compressName);
         return;
     }
-    updateLogFiles();
-    cleanOldFiles();
+
+    std::shared_ptr<ZipSnapshot> snapshot(new ZipSnapshot());
+    snapshot->compressName = compressName;
+    snapshot->nowFileName = conf.strConf[LC_LOG_FILE_NAME] + ".log";
+    // 日志线程只负责让当前文件的内容完整：等已提交的数据写完后保留一个句柄，
+    // 维护线程中排队的滚动改名不影响之后读取
+    if (m_logFd >= 0) {
+        flushLogs();
+        m_writer->detach();
+        snapshot->nowFd = dup(m_logFd);
+        snapshot->nowSize = m_curFileSize;
+        attachFile(m_logFd, path + "/" + snapshot->nowFileName);
+    } else {
+        struct stat st;
+        snapshot->nowFd = open((path + "/" + snapshot->nowFileName).c_str(), O_RDONLY | O_CLOEXEC);
+        if (snapshot->nowFd >= 0 && 0 == fstat(snapshot->nowFd, &st)) {
+            snapshot->nowSize = (uint64_t)st.st_size;
+        }
+    }
+
+    // 目录操作和打包都不在日志线程中等待：维护线程执行完之前的改名和清理后取索引快照，
+    // 再交给压缩线程打包并回调
+    std::shared_ptr<const LogConfig> confPtr = m_writerConf;
+    postHouseTask([this, confPtr, snapshot]() {
+        updateLogFiles(*confPtr);
+        cleanOldFiles(*confPtr);
+        snapshot->allFiles = m_allFiles;
+        postPackTask([this, confPtr, snapshot]() { buildZip(confPtr, snapshot); }, true);
+    });
+}
+
+LogFile::ZipSnapshot::~ZipSnapshot() {
+    if (nowFd >= 0) {
+        close(nowFd);
+    }
+}
+
+void LogFile::buildZip(const std::shared_ptr<const LogConfig>& confPtr,
+                       const std::shared_ptr<ZipSnapshot>& snapshot) {
+    const LogConfig& conf = *confPtr;
+    const std::string& path = conf.strConf[LC_LOG_OUTPUT_PATH];
+    const std::string& compressName = snapshot->compressName;
+    const std::map<uint32_t, std::string>& allFiles = snapshot->allFiles;
+    // 未变化的已滚动文件直接从上次的zip中拷贝压缩数据
+    std::shared_ptr<const std::string> oldZip;
+    std::map<std::string, ZipCacheEntry> oldCache;
     {
-        if (0 == access(compressName.c_str(), F_OK) && unlink(compressName.c_str()) < 0) {
-            fprintf(stderr, "%s [ERROR] %s-%d unlink old zip data %s failed \n",
-                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__,
-                    compressName.c_str());
+        std::lock_guard<std::mutex> lock(m_zipMutex);
+        if (m_zipCachePath == compressName) {
+            oldZip = m_zipData;
+            oldCache.swap(m_zipCache);
         }
+        clearZipCache();
+    }
 
-        HZIP hz = CreateZip(compressName.c_str(), 0);
-        for (std::map<uint32_t, std::string>::iterator it = m_allFiles.begin();
-             it != m_allFiles.end(); ++it) {
-            std::string fileName = path + "/" + it->second;
-            if (0 == access(fileName.c_str(), F_OK)) {
-                ZipAdd(hz, it->second.c_str(), fileName.c_str());
+    // 直接在内存中打包，按上次的大小预留空间，避免反复扩容
+    std::shared_ptr<std::string> zipData(new std::string());
+    zipData->reserve(oldZip ? oldZip->size() + oldZip->size() / 4 : 0);
+    HZIP hz = CreateZip(zipData.get(), 0);
+    if (hz != 0) {
+        ZipSetThreads(hz, getZipThreads(conf));
+    }
+    std::vector<std::pair<int, std::map<std::string, ZipCacheEntry>::value_type>> added;
+    int zipIndex = 0;
+    struct stat st;
+    for (std::map<uint32_t, std::string>::const_iterator it = allFiles.begin();
+         hz != 0 && it != allFiles.end(); ++it) {
+        std::string fileName = path + "/" + it->second;
+        if (0 != stat(fileName.c_str(), &st)) {
+            continue;
+        }
+        ZipCacheEntry entry;
+        entry.size = (uint64_t)st.st_size;
+        entry.mtimeNs = getMtimeNs(st);
+        // 滚动后压缩过的文件以原文件名打包
+        bool packed = hasSuffix(it->second, kLogPackSuffix);
+        std::string entryName =
+            packed ? it->second.substr(0, it->second.size() - strlen(kLogPackSuffix))
+                   : it->second;
+        std::map<std::string, ZipCacheEntry>::iterator cached = oldCache.find(it->second);
+        ZRESULT res = ZR_FAILED;
+        if (oldZip && cached != oldCache.end() && cached->second.size == entry.size &&
+            cached->second.mtimeNs == entry.mtimeNs &&
+            cached->second.raw.offset + cached->second.raw.csize <= oldZip->size()) {
+            res = ZipAddRaw(hz, entryName.c_str(), &cached->second.raw,
+                            oldZip->data() + cached->second.raw.offset);
+        } else if (packed) {
+            size_t packSize = 0;
+            const char* pack = mapWholeFile(fileName, packSize);
+            ZIPRAW raw;
+            if (pack && parseZipEntry(pack, packSize, st, raw)) {
+                res = ZipAddRaw(hz, entryName.c_str(), &raw, pack + raw.offset);
+            }
+            if (pack) {
+                munmap((void*)pack, packSize);
             }
+        } else {
+            res = ZipAdd(hz, entryName.c_str(), fileName.c_str());
         }
-        if (0 == access(nowLogPath.c_str(), F_OK)) {
-            fclose(m_logFd);
-            m_logFd = nullptr;
-            ZipAdd(hz, nowFileName.c_str(), nowLogPath.c_str());
+        if (ZR_OK == res) {
+            added.push_back(std::make_pair(zipIndex++, std::make_pair(it->second, entry)));
         }
-        CloseZip(hz);
+    }
+    if (hz != 0 && snapshot->nowFd >= 0) {
+        // 只打包快照时已经写完的部分
+        void* now = MAP_FAILED;
+        if (snapshot->nowSize > 0) {
+            now = mmap(NULL, (size_t)snapshot->nowSize, PROT_READ, MAP_SHARED,
+                       snapshot->nowFd, 0);
+        }
+        char empty = 0;
+        ZipAdd(hz, snapshot->nowFileName.c_str(), now != MAP_FAILED ? now : (void*)&empty,
+               now != MAP_FAILED ? (unsigned int)snapshot->nowSize : 0);
+        if (now != MAP_FAILED) {
+            munmap(now, (size_t)snapshot->nowSize);
+        }
+    }
+    // 当前日志文件还会继续写入，不缓存
+    for (size_t i = 0; i < added.size(); ++i) {
+        if (ZR_OK == ZipGetRaw(hz, added[i].first, &added[i].second.second.raw)) {
+            m_zipCache.insert(added[i].second);
+        }
+    }
+    oldZip.reset();
+    ZRESULT closeRes = hz != 0 ? CloseZip(hz) : ZR_NOFILE;
+    if (ZR_OK != closeRes) {
+        fprintf(stderr, "%s [ERROR] %s-%d create zip data %s failed, result:%lu \n",
+                Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__,
+                compressName.c_str(), (unsigned long)closeRes);
+        zipData->clear();
+    }
+    if (0 != conf.intConf[LC_LOG_ZIP_SAVE_FILE]) {
+        saveZipFile(compressName, *zipData);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_zipMutex);
+        if (ZR_OK != closeRes) {
+            clearZipCache();
+        } else {
+            m_zipCachePath = compressName;
+        }
+        m_zipData = zipData;
         m_lastCompressStamp = Utils::getTickCount();
+        m_zipPending = false;
     }
     onCompressData(compressName);
-    return;
 }
 
-void LogFile::onCompressData(std::string compressLogPath) {
-    std::string zipData = "";
-    {
-        if (0 == access(compressLogPath.c_str(), F_OK)) {
-            FILE* zipFd = fopen(compressLogPath.c_str(), "r");
-            if (!zipFd) {
-                fprintf(stderr, "%s [ERROR] %s-%d  open zip data %s failed \n",
-                        Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__,
-                        compressLogPath.c_str());
-                zipData = "";
-            } else {
-                fseek(zipFd, 0, SEEK_END);
-                int32_t length = ftell(zipFd);
-                char* data = (char*)malloc((length + 1) * sizeof(char));
-                rewind(zipFd);
-                length = fread(data, 1, length, zipFd);
-                data[length] = '\0';
-                zipData = std::string(data, length);
-                delete[] data;
-            }
+void LogFile::clearZipCache() {
+    m_zipData.reset();
+    m_zipCache.clear();
+    m_zipCachePath.clear();
+}
+
+void LogFile::saveZipFile(const std::string& compressLogPath, const std::string& zipData) {
+    // 先写临时文件再改名，读到的<app>.zip总是完整的
+    std::string tmpName = compressLogPath + ".tmp";
+    int fd = open(tmpName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    size_t written = 0;
+    while (fd >= 0 && written < zipData.size()) {
+        ssize_t ret = write(fd, zipData.data() + written, zipData.size() - written);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            break;
         }
+        written += (size_t)ret;
     }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (fd < 0 || written != zipData.size() || rename(tmpName.c_str(), compressLogPath.c_str()) < 0) {
+        fprintf(stderr, "%s [ERROR] %s-%d save zip data %s failed, errno %d\n",
+                Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__,
+                compressLogPath.c_str(), errno);
+        unlink(tmpName.c_str());
+    }
+}
 
-    {
-        std::lock_guard<std::mutex> lock(m_zipMutex);
-        for (std::set<std::weak_ptr<ZipLogCallBack>>::iterator it = m_zipCallBacks.begin();
-             it != m_zipCallBacks.end(); ++it) {
-            if (!(*it).expired()) {
-                std::shared_ptr<ZipLogCallBack> callback = (*it).lock();
-                callback->onRecvZipLog(compressLogPath, zipData);
-            }
+void LogFile::onCompressData(const std::string& compressLogPath) {
+    std::lock_guard<std::mutex> lock(m_zipMutex);
+    std::shared_ptr<const std::string> zipData = m_zipData;
+    if (!zipData) {
+        zipData = std::shared_ptr<const std::string>(new std::string());
+    }
+    for (std::set<std::weak_ptr<ZipLogCallBack>>::iterator it = m_zipCallBacks.begin();
+         it != m_zipCallBacks.end(); ++it) {
+        std::shared_ptr<ZipLogCallBack> callback = (*it).lock();
+        if (callback) {
+            callback->onRecvZipData(compressLogPath, zipData);
         }
-        m_zipCallBacks.clear();
     }
+    m_zipCallBacks.clear();
 }
 
 }  // end namespace dailycode
@@ -0,0 +1,160 @@
+/***************************************************************************
+*
+* Copyright (c) 2020 jackszhang, All Rights Reserved
+*
+* @file    log_sink.cpp
+* @author  jackszhang
+* @date    2020/11/15
+* @brief   The interface of log sink
+*
+**************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include "log_sink.h"
+#include "log_file.h"
+
+namespace dailycode {
+
+#define kLogSinkFreeBatchCnt 2  // 最多缓存的空闲批次数
+
+void ConsoleLogSink::write(int32_t, const char* data, size_t len) {
+    fwrite(data, 1, len, stdout);
+    fputc('\n', stdout);
+}
+
+void ConsoleLogSink::flush() { fflush(stdout); }
+
+void MemoryLogSink::write(int32_t, const char* data, size_t len) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_lines.size() >= m_maxLines) {
+        // 复用最早一条的内存
+        std::string oldest;
+        oldest.swap(m_lines.front());
+        m_lines.pop_front();
+        oldest.assign(data, len);
+        m_lines.push_back(std::string());
+        m_lines.back().swap(oldest);
+        return;
+    }
+    m_lines.push_back(std::string(data, len));
+}
+
+std::vector<std::string> MemoryLogSink::getLogs() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::vector<std::string>(m_lines.begin(), m_lines.end());
+}
+
+LogSinkChannel::LogSinkChannel(int32_t id, const std::shared_ptr<LogSink>& sink,
+                               uint32_t levelMask, size_t maxPending)
+    : m_id(id),
+      m_sink(sink),
+      m_levelMask(levelMask),
+      m_maxPending(maxPending > 0 ? maxPending : 1),
+      m_queuedCnt(0),
+      m_dropped(0),
+      m_unreported(0),
+      m_stop(false) {
+    m_worker = std::thread(&LogSinkChannel::workerFunc, this);
+}
+
+LogSinkChannel::~LogSinkChannel() {
+    submit();
+    stop();
+}
+
+void LogSinkChannel::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_one();
+    if (m_worker.joinable()) {
+        m_worker.join();
+    }
+}
+
+void LogSinkChannel::append(int32_t level, const char* data, size_t len) {
+    if (m_queuedCnt.load(std::memory_order_relaxed) + m_pending.records.size() >= m_maxPending) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        m_unreported.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    m_pending.text.append(data, len);
+    m_pending.records.push_back(std::make_pair(level, (uint32_t)len));
+}
+
+void LogSinkChannel::submit() {
+    if (m_pending.records.empty()) {
+        return;
+    }
+    size_t cnt = m_pending.records.size();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // 工作线程已经退出或即将退出，之后的日志不再输出，计入丢弃
+        if (m_stop) {
+            m_pending.text.clear();
+            m_pending.records.clear();
+            m_dropped.fetch_add(cnt, std::memory_order_relaxed);
+            return;
+        }
+        m_batches.push_back(Batch());
+        m_batches.back().text.swap(m_pending.text);
+        m_batches.back().records.swap(m_pending.records);
+        if (!m_freeBatches.empty()) {
+            m_pending.text.swap(m_freeBatches.back().text);
+            m_pending.records.swap(m_freeBatches.back().records);
+            m_freeBatches.pop_back();
+        }
+    }
+    m_queuedCnt.fetch_add(cnt, std::memory_order_relaxed);
+    m_cond.notify_one();
+}
+
+void LogSinkChannel::workerFunc() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_cond.wait(lock, [this]() { return m_stop || !m_batches.empty(); });
+        // stop后仍写完已提交的批次，队列为空才退出
+        if (m_batches.empty()) {
+            break;
+        }
+        Batch batch;
+        batch.text.swap(m_batches.front().text);
+        batch.records.swap(m_batches.front().records);
+        m_batches.pop_front();
+        lock.unlock();
+
+        writeBatch(batch);
+        m_queuedCnt.fetch_sub(batch.records.size(), std::memory_order_relaxed);
+
+        lock.lock();
+        if (m_freeBatches.size() < kLogSinkFreeBatchCnt) {
+            batch.text.clear();
+            batch.records.clear();
+            m_freeBatches.push_back(Batch());
+            m_freeBatches.back().text.swap(batch.text);
+            m_freeBatches.back().records.swap(batch.records);
+        }
+    }
+}
+
+void LogSinkChannel::writeBatch(const Batch& batch) {
+    uint64_t unreported = m_unreported.exchange(0, std::memory_order_relaxed);
+    if (unreported > 0) {
+        char buf[64];
+        int len = snprintf(buf, sizeof(buf), "sink dropped %llu logs by overflow",
+                           (unsigned long long)unreported);
+        len = std::max(std::min(len, (int)sizeof(buf) - 1), 0);
+        m_sink->write(LL_LOG_WARN, buf, (size_t)len);
+    }
+    const char* data = batch.text.data();
+    for (size_t i = 0; i < batch.records.size(); ++i) {
+        m_sink->write(batch.records[i].first, data, batch.records[i].second);
+        data += batch.records[i].second;
+    }
+    m_sink->flush();
+}
+
+}  // end namespace dailycode
@@ -0,0 +1,674 @@
+/***************************************************************************
+*
+* Copyright (c) 2020 jackszhang, All Rights Reserved
+*
+* @file    log_writer.cpp
+* @author  jackszhang
+* @date    2020/10/25
+* @brief   The interface of log writer
+*
+**************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "log_writer.h"
+#include "utils.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define DAILYCODE_HAS_IO_URING 1
+#endif
+#endif
+
+namespace dailycode {
+
+#define kLogAsyncBufferCnt 4                // 同时在途的写缓冲区个数
+#define kLogAsyncBufferSize (1024 * 1024)   // 单个写缓冲区大小
+#define kLogAsyncAlignSize 4096             // 缓冲区地址及O_DIRECT写入的对齐大小
+#define kLogAsyncPoolThreadCnt 2            // pwrite线程池的线程数
+#define kLogMmapMinSize (1024 * 1024)       // mmap写入时的最小映射大小
+#define kLogMmapMarker "\0DCMMAP\n"         // mmap写入时映射区末尾的标记，detach截断后消失
+#define kLogMmapMarkerLen 8
+
+// 同步写，与原来日志线程直接write的行为一致
+class SyncLogWriter : public LogWriter {
+ public:
+    SyncLogWriter() : m_fd(-1), m_offset(0) {}
+
+    virtual bool attach(int fd, uint64_t offset, uint64_t) {
+        m_fd = fd;
+        m_offset = offset;
+        return true;
+    }
+
+    virtual bool write(const char* data, size_t len) {
+        // 整批数据一次write，只在被信号打断或部分写入时重试
+        while (len > 0) {
+            ssize_t ret = ::write(m_fd, data, len);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "%s [ERROR] %s-%d write log file failed, errno %d\n",
+                        Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, errno);
+                return false;
+            }
+            data += ret;
+            len -= ret;
+            m_offset += ret;
+        }
+        return true;
+    }
+
+    virtual void detach() { m_fd = -1; }
+
+    virtual uint64_t offset() const { return m_offset; }
+
+ private:
+    int m_fd;
+    uint64_t m_offset;
+};
+
+// 异步写的公共部分：
+// 1. 多个页对齐的缓冲区轮流使用，日志线程格式化/加密下一批时，上一批在后台写入
+// 2. 文件按偏移写入，因此attach时去掉O_APPEND
+// 3. O_DIRECT要求偏移和长度按块对齐，最后一个不完整的块补0写入，下一批从该块开头覆盖写，
+//    detach时再把文件截断到真实大小
+class AsyncLogWriter : public LogWriter {
+ public:
+    explicit AsyncLogWriter(bool directIo)
+        : m_fd(-1),
+          m_inflight(0),
+          m_offset(0),
+          m_directIo(directIo),
+          m_directActive(false),
+          m_failed(false),
+          m_tailBlock(nullptr) {
+        memset(m_buffers, 0, sizeof(m_buffers));
+    }
+
+    virtual ~AsyncLogWriter() {
+        for (int32_t i = 0; i < kLogAsyncBufferCnt; ++i) {
+            free(m_buffers[i].data);
+        }
+        free(m_tailBlock);
+    }
+
+    virtual bool init() {
+        for (int32_t i = 0; i < kLogAsyncBufferCnt; ++i) {
+            void* data = nullptr;
+            if (0 != posix_memalign(&data, kLogAsyncAlignSize, kLogAsyncBufferSize)) {
+                return false;
+            }
+            m_buffers[i].data = (char*)data;
+        }
+        m_tailBlock = (char*)malloc(kLogAsyncAlignSize);
+        return m_tailBlock != nullptr;
+    }
+
+    virtual bool attach(int fd, uint64_t offset, uint64_t) {
+        m_fd = fd;
+        m_offset = offset;
+        m_failed = false;
+        m_directActive = false;
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0) {
+            return false;
+        }
+        // O_APPEND会让pwrite忽略偏移
+        flags &= ~O_APPEND;
+        if (m_directIo) {
+            // 已有内容不是块对齐时，先读出最后一个不完整的块，之后从该块开头覆盖写
+            size_t head = (size_t)(offset % kLogAsyncAlignSize);
+            if (head > 0 && pread(fd, m_tailBlock, head, offset - head) != (ssize_t)head) {
+                fprintf(stderr, "%s [WARN] %s-%d read log file tail failed, errno %d\n",
+                        Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, errno);
+            } else if (0 == fcntl(fd, F_SETFL, flags | O_DIRECT)) {
+                m_directActive = true;
+            } else {
+                fprintf(stderr, "%s [WARN] %s-%d O_DIRECT is not supported, errno %d\n",
+                        Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, errno);
+            }
+        }
+        return m_directActive || 0 == fcntl(fd, F_SETFL, flags);
+    }
+
+    virtual bool write(const char* data, size_t len) {
+        if (m_fd < 0) {
+            return false;
+        }
+        while (len > 0) {
+            WriteBuffer* buf = acquireBuffer();
+            size_t head = m_directActive ? (size_t)(m_offset % kLogAsyncAlignSize) : 0;
+            if (head > 0) {
+                memcpy(buf->data, m_tailBlock, head);
+            }
+            size_t cnt = std::min(len, (size_t)kLogAsyncBufferSize - head);
+            memcpy(buf->data + head, data, cnt);
+            size_t total = head + cnt;
+            buf->offset = m_offset - head;
+            m_offset += cnt;
+            data += cnt;
+            len -= cnt;
+            if (m_directActive && total % kLogAsyncAlignSize > 0) {
+                size_t tail = total % kLogAsyncAlignSize;
+                memcpy(m_tailBlock, buf->data + total - tail, tail);
+                memset(buf->data + total, 0, kLogAsyncAlignSize - tail);
+                total += kLogAsyncAlignSize - tail;
+            }
+            buf->len = total;
+            buf->done = 0;
+            buf->busy = true;
+            ++m_inflight;
+            if (!submit(buf)) {
+                fprintf(stderr, "%s [ERROR] %s-%d submit log write failed, errno %d\n",
+                        Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, errno);
+                buf->busy = false;
+                --m_inflight;
+                m_failed = true;
+            }
+        }
+        bool ret = !m_failed;
+        m_failed = false;
+        return ret;
+    }
+
+    virtual void detach() {
+        if (m_fd < 0) {
+            return;
+        }
+        waitAll();
+        if (m_directActive && 0 != ftruncate(m_fd, m_offset)) {
+            fprintf(stderr, "%s [ERROR] %s-%d truncate log file failed, errno %d\n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, errno);
+        }
+        m_fd = -1;
+    }
+
+    virtual uint64_t offset() const { return m_offset; }
+
+ protected:
+    struct WriteBuffer {
+        char* data;
+        size_t len;   // 需要写入的长度，O_DIRECT时按块对齐
+        size_t done;  // 已经写入的长度
+        uint64_t offset;
+        bool busy;
+        struct iovec iov;
+    };
+
+    // 提交buf中done之后的部分，失败时返回false
+    virtual bool submit(WriteBuffer* buf) = 0;
+
+    // 阻塞等待至少一个写请求完成，并对其调用complete
+    virtual void waitComplete() = 0;
+
+    // 处理写请求的结果，ret为写入的字节数或者-errno，部分写入时继续提交剩余部分
+    void complete(WriteBuffer* buf, ssize_t ret) {
+        if (-EINTR == ret || -EAGAIN == ret) {
+            ret = 0;
+        } else if (ret <= 0) {
+            fprintf(stderr, "%s [ERROR] %s-%d write log file failed, errno %d\n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, (int)-ret);
+            m_failed = true;
+            buf->busy = false;
+            --m_inflight;
+            return;
+        }
+        buf->done += ret;
+        if (buf->done < buf->len) {
+            if (submit(buf)) {
+                return;
+            }
+            m_failed = true;
+        }
+        buf->busy = false;
+        --m_inflight;
+    }
+
+    // 无法再等待完成事件时放弃所有在途的请求
+    void abandonAll() {
+        for (int32_t i = 0; i < kLogAsyncBufferCnt; ++i) {
+            if (m_buffers[i].busy) {
+                complete(&m_buffers[i], -EIO);
+            }
+        }
+    }
+
+ protected:
+    int m_fd;
+
+ private:
+    WriteBuffer* acquireBuffer() {
+        // 上一批的最后一个块需要被覆盖写，必须等它写完，避免新旧数据乱序落盘
+        if (m_directActive && m_offset % kLogAsyncAlignSize > 0) {
+            waitAll();
+        }
+        while (true) {
+            for (int32_t i = 0; i < kLogAsyncBufferCnt; ++i) {
+                if (!m_buffers[i].busy) {
+                    return &m_buffers[i];
+                }
+            }
+            waitComplete();
+        }
+    }
+
+    void waitAll() {
+        while (m_inflight > 0) {
+            waitComplete();
+        }
+    }
+
+ private:
+    WriteBuffer m_buffers[kLogAsyncBufferCnt];
+    uint32_t m_inflight;
+    uint64_t m_offset;
+    bool m_directIo;      // 配置是否使用O_DIRECT
+    bool m_directActive;  // 当前文件是否实际使用了O_DIRECT
+    bool m_failed;
+    char* m_tailBlock;    // O_DIRECT时最后一个不完整块的内容
+};
+
+#ifdef DAILYCODE_HAS_IO_URING
+// 基于io_uring的异步写，直接使用系统调用，不依赖liburing
+class IoUringLogWriter : public AsyncLogWriter {
+ public:
+    explicit IoUringLogWriter(bool directIo)
+        : AsyncLogWriter(directIo),
+          m_ringFd(-1),
+          m_sqPtr(MAP_FAILED),
+          m_sqSize(0),
+          m_cqPtr(MAP_FAILED),
+          m_cqSize(0),
+          m_sqes((struct io_uring_sqe*)MAP_FAILED),
+          m_sqesSize(0) {
+        memset(&m_params, 0, sizeof(m_params));
+    }
+
+    virtual ~IoUringLogWriter() {
+        if (m_sqes != MAP_FAILED) {
+            munmap(m_sqes, m_sqesSize);
+        }
+        if (m_cqPtr != MAP_FAILED && m_cqPtr != m_sqPtr) {
+            munmap(m_cqPtr, m_cqSize);
+        }
+        if (m_sqPtr != MAP_FAILED) {
+            munmap(m_sqPtr, m_sqSize);
+        }
+        if (m_ringFd >= 0) {
+            close(m_ringFd);
+        }
+    }
+
+    virtual bool init() {
+        if (!AsyncLogWriter::init()) {
+            return false;
+        }
+        m_ringFd = (int)syscall(__NR_io_uring_setup, kLogAsyncBufferCnt * 2, &m_params);
+        if (m_ringFd < 0) {
+            return false;
+        }
+        m_sqSize = m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned);
+        m_cqSize = m_params.cq_off.cqes + m_params.cq_entries * sizeof(struct io_uring_cqe);
+        bool singleMmap = false;
+#ifdef IORING_FEAT_SINGLE_MMAP
+        singleMmap = (m_params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#endif
+        if (singleMmap) {
+            m_sqSize = m_cqSize = std::max(m_sqSize, m_cqSize);
+        }
+        m_sqPtr = mmap(nullptr, m_sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       m_ringFd, IORING_OFF_SQ_RING);
+        if (m_sqPtr == MAP_FAILED) {
+            return false;
+        }
+        m_cqPtr = singleMmap ? m_sqPtr
+                             : mmap(nullptr, m_cqSize, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+        if (m_cqPtr == MAP_FAILED) {
+            return false;
+        }
+        m_sqesSize = m_params.sq_entries * sizeof(struct io_uring_sqe);
+        m_sqes = (struct io_uring_sqe*)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, m_ringFd,
+                                            IORING_OFF_SQES);
+        if (m_sqes == MAP_FAILED) {
+            return false;
+        }
+        char* sq = (char*)m_sqPtr;
+        m_sqHead = (unsigned*)(sq + m_params.sq_off.head);
+        m_sqTail = (unsigned*)(sq + m_params.sq_off.tail);
+        m_sqMask = (unsigned*)(sq + m_params.sq_off.ring_mask);
+        m_sqArray = (unsigned*)(sq + m_params.sq_off.array);
+        char* cq = (char*)m_cqPtr;
+        m_cqHead = (unsigned*)(cq + m_params.cq_off.head);
+        m_cqTail = (unsigned*)(cq + m_params.cq_off.tail);
+        m_cqMask = (unsigned*)(cq + m_params.cq_off.ring_mask);
+        m_cqes = (struct io_uring_cqe*)(cq + m_params.cq_off.cqes);
+        return true;
+    }
+
+ protected:
+    virtual bool submit(WriteBuffer* buf) {
+        unsigned tail = *m_sqTail;
+        if (tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_params.sq_entries) {
+            errno = EBUSY;
+            return false;
+        }
+        unsigned index = tail & *m_sqMask;
+        struct io_uring_sqe* sqe = &m_sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        buf->iov.iov_base = buf->data + buf->done;
+        buf->iov.iov_len = buf->len - buf->done;
+        // WRITEV从5.1开始支持，兼容更多内核
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = m_fd;
+        sqe->off = buf->offset + buf->done;
+        sqe->addr = (uint64_t)(uintptr_t)&buf->iov;
+        sqe->len = 1;
+        sqe->user_data = (uint64_t)(uintptr_t)buf;
+        m_sqArray[index] = index;
+        __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+        int ret = 0;
+        do {
+            ret = (int)syscall(__NR_io_uring_enter, m_ringFd, 1, 0, 0, nullptr, 0);
+        } while (ret < 0 && errno == EINTR);
+        // 没有SQPOLL时内核只在enter中取SQE：已取走的请求一定会有CQE，即使enter返回错误，
+        // buf也要等CQE到达后才能复用；未取走时撤回tail，避免下次enter写入复用后的buf
+        if (__atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) == tail + 1) {
+            return true;
+        }
+        __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+        if (ret >= 0) {
+            errno = EAGAIN;
+        }
+        return false;
+    }
+
+    virtual void waitComplete() {
+        unsigned head = *m_cqHead;
+        while (head == __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+            int ret = (int)syscall(__NR_io_uring_enter, m_ringFd, 0, 1, IORING_ENTER_GETEVENTS,
+                                   nullptr, 0);
+            if (ret < 0 && errno != EINTR) {
+                fprintf(stderr, "%s [ERROR] %s-%d wait io_uring failed, errno %d\n",
+                        Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, errno);
+                abandonAll();
+                return;
+            }
+        }
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &m_cqes[head & *m_cqMask];
+            WriteBuffer* buf = (WriteBuffer*)(uintptr_t)cqe->user_data;
+            ssize_t res = cqe->res;
+            ++head;
+            // 先归还CQ槽位，complete中可能再次提交
+            __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+            complete(buf, res);
+        }
+    }
+
+ private:
+    int m_ringFd;
+    struct io_uring_params m_params;
+    void* m_sqPtr;
+    size_t m_sqSize;
+    void* m_cqPtr;
+    size_t m_cqSize;
+    struct io_uring_sqe* m_sqes;
+    size_t m_sqesSize;
+    unsigned* m_sqHead;
+    unsigned* m_sqTail;
+    unsigned* m_sqMask;
+    unsigned* m_sqArray;
+    unsigned* m_cqHead;
+    unsigned* m_cqTail;
+    unsigned* m_cqMask;
+    struct io_uring_cqe* m_cqes;
+};
+#endif
+
+// 内核不支持io_uring时，由线程池pwrite完成异步写
+class ThreadPoolLogWriter : public AsyncLogWriter {
+ public:
+    explicit ThreadPoolLogWriter(bool directIo) : AsyncLogWriter(directIo), m_stop(false) {}
+
+    virtual ~ThreadPoolLogWriter() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_jobCond.notify_all();
+        for (size_t i = 0; i < m_threads.size(); ++i) {
+            m_threads[i]->join();
+        }
+    }
+
+    virtual bool init() {
+        if (!AsyncLogWriter::init()) {
+            return false;
+        }
+        for (int32_t i = 0; i < kLogAsyncPoolThreadCnt; ++i) {
+            m_threads.push_back(std::shared_ptr<std::thread>(
+                new std::thread(&ThreadPoolLogWriter::threadFunc, this)));
+        }
+        return true;
+    }
+
+ protected:
+    virtual bool submit(WriteBuffer* buf) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back(buf);
+        }
+        m_jobCond.notify_one();
+        return true;
+    }
+
+    virtual void waitComplete() {
+        std::vector<std::pair<WriteBuffer*, ssize_t>> done;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_doneCond.wait(lock, [this] { return !m_done.empty(); });
+            done.swap(m_done);
+        }
+        for (size_t i = 0; i < done.size(); ++i) {
+            complete(done[i].first, done[i].second);
+        }
+    }
+
+ private:
+    void threadFunc() {
+        while (true) {
+            WriteBuffer* buf = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_jobCond.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+                if (m_jobs.empty()) {
+                    return;
+                }
+                buf = m_jobs.front();
+                m_jobs.pop_front();
+            }
+            ssize_t ret = pwrite(m_fd, buf->data + buf->done, buf->len - buf->done,
+                                 buf->offset + buf->done);
+            if (ret < 0) {
+                ret = -errno;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_done.push_back(std::make_pair(buf, ret));
+            }
+            m_doneCond.notify_one();
+        }
+    }
+
+ private:
+    std::mutex m_mutex;
+    std::condition_variable m_jobCond;
+    std::condition_variable m_doneCond;
+    std::deque<WriteBuffer*> m_jobs;
+    std::vector<std::pair<WriteBuffer*, ssize_t>> m_done;
+    std::vector<std::shared_ptr<std::thread>> m_threads;
+    bool m_stop;
+};
+
+// 预分配并映射整个文件，日志线程把数据直接拷贝到映射区：
+// 1. 稳定写入时没有系统调用，数据拷贝完成即进入page cache，进程崩溃也不会丢失
+// 2. 映射区最后kLogMmapMarkerLen字节写入标记，detach时解除映射并把文件截断到真实大小
+// 3. 崩溃后文件末尾仍是标记和预分配的0，再次attach时只在这种情况下跳过末尾的0，
+//    正常关闭的文件原样追加，不会误删以0结尾的加密或压缩数据
+class MmapLogWriter : public LogWriter {
+ public:
+    MmapLogWriter() : m_fd(-1), m_offset(0), m_map(nullptr), m_mapSize(0) {}
+
+    virtual ~MmapLogWriter() { detach(); }
+
+    virtual bool attach(int fd, uint64_t offset, uint64_t maxSize) {
+        m_fd = fd;
+        m_offset = offset;
+        bool crashed = hasMarker(offset);
+        if (crashed) {
+            m_offset = offset - kLogMmapMarkerLen;
+        }
+        if (!remap(std::max(offset, maxSize))) {
+            m_fd = -1;
+            return false;
+        }
+        // 通过映射清掉旧标记，文件以O_APPEND打开，pwrite会忽略偏移追加到末尾；
+        // 映射大小不变时新标记就在原处，不能清
+        if (crashed && m_offset + kLogMmapMarkerLen != m_mapSize) {
+            memset(m_map + m_offset, 0, kLogMmapMarkerLen);
+        }
+        // 异常退出的文件中，每条日志之后的0只可能来自预分配
+        while (crashed && m_offset > 0 && '\0' == m_map[m_offset - 1]) {
+            --m_offset;
+        }
+        return true;
+    }
+
+    virtual bool write(const char* data, size_t len) {
+        if (m_fd < 0) {
+            return false;
+        }
+        if (m_offset + len + kLogMmapMarkerLen > m_mapSize &&
+            !remap(std::max(m_mapSize * 2, m_offset + len + kLogMmapMarkerLen))) {
+            return false;
+        }
+        memcpy(m_map + m_offset, data, len);
+        m_offset += len;
+        return true;
+    }
+
+    virtual void detach() {
+        if (m_fd < 0) {
+            return;
+        }
+        unmap();
+        if (0 != ftruncate(m_fd, m_offset)) {
+            fprintf(stderr, "%s [ERROR] %s-%d truncate log file failed, errno %d\n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, errno);
+        }
+        m_fd = -1;
+    }
+
+    virtual uint64_t offset() const { return m_offset; }
+
+ private:
+    // 文件大小是预分配的整页大小且末尾是标记时，说明上次没有正常detach
+    bool hasMarker(uint64_t size) {
+        long pageSize = sysconf(_SC_PAGESIZE);
+        if (size < kLogMmapMinSize || 0 != size % pageSize) {
+            return false;
+        }
+        char tail[kLogMmapMarkerLen];
+        if (pread(m_fd, tail, kLogMmapMarkerLen, size - kLogMmapMarkerLen) != kLogMmapMarkerLen) {
+            return false;
+        }
+        return 0 == memcmp(tail, kLogMmapMarker, kLogMmapMarkerLen);
+    }
+
+    // 预分配文件到size并重新映射，旧标记清零，新标记写在映射区末尾
+    bool remap(uint64_t size) {
+        if (m_map) {
+            memset(m_map + m_mapSize - kLogMmapMarkerLen, 0, kLogMmapMarkerLen);
+        }
+        unmap();
+        long pageSize = sysconf(_SC_PAGESIZE);
+        size = std::max(size, (uint64_t)kLogMmapMinSize);
+        size = (size + pageSize - 1) / pageSize * pageSize;
+        // 预分配真实的磁盘空间，避免写映射区时因磁盘满触发SIGBUS
+        int ret = posix_fallocate(m_fd, 0, size);
+        if (0 != ret) {
+            fprintf(stderr, "%s [ERROR] %s-%d allocate log file failed, errno %d\n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, ret);
+            return false;
+        }
+        void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "%s [ERROR] %s-%d mmap log file failed, errno %d\n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, errno);
+            return false;
+        }
+        m_map = (char*)map;
+        m_mapSize = size;
+        memcpy(m_map + m_mapSize - kLogMmapMarkerLen, kLogMmapMarker, kLogMmapMarkerLen);
+        return true;
+    }
+
+    void unmap() {
+        if (m_map) {
+            munmap(m_map, m_mapSize);
+            m_map = nullptr;
+            m_mapSize = 0;
+        }
+    }
+
+ private:
+    int m_fd;
+    uint64_t m_offset;
+    char* m_map;
+    uint64_t m_mapSize;
+};
+
+std::shared_ptr<LogWriter> LogWriter::create(int32_t mode, bool directIo) {
+    if (LWM_MMAP == mode) {
+        return std::shared_ptr<LogWriter>(new MmapLogWriter());
+    }
+    if (LWM_ASYNC == mode) {
+#ifdef DAILYCODE_HAS_IO_URING
+        std::shared_ptr<IoUringLogWriter> uringWriter(new IoUringLogWriter(directIo));
+        if (uringWriter->init()) {
+            return uringWriter;
+        }
+        fprintf(stderr, "%s [WARN] %s-%d io_uring is not available, errno %d, use pwrite\n",
+                Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, errno);
+#endif
+        std::shared_ptr<ThreadPoolLogWriter> poolWriter(new ThreadPoolLogWriter(directIo));
+        if (poolWriter->init()) {
+            return poolWriter;
+        }
+        fprintf(stderr, "%s [ERROR] %s-%d create async log writer failed, use sync write\n",
+                Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__);
+    }
+    return std::shared_ptr<LogWriter>(new SyncLogWriter());
+}
+
+}  // end namespace dailycode
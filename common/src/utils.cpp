@@ -36,19 +36,71 @@
 
 namespace dailycode {
 
+// 线程私有的秒级时间文本缓存，同一秒内只需要改写小数部分
+struct SecondTextCache {
+    time_t second;
+    char text[20];  // "YYYY-mm-dd HH:MM:SS"
+};
+
+static thread_local SecondTextCache tlsSecondCache = {(time_t)-1, {0}};
+
 const std::string Utils::getCurrentSystemTime() {
-    struct timeval curTime;
-    gettimeofday(&curTime, NULL);
-    char date[100] = {0};
-    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&curTime.tv_sec));
-    return std::string(date) + "." + std::to_string(curTime.tv_usec / 1000);
+    char date[kSystemTimeMaxLen + 1];
+    size_t len = formatSystemTime(date, sizeof(date));
+    return std::string(date, len);
+}
+
+size_t Utils::formatSystemTime(char* buf, size_t len, int32_t flags) {
+    struct timespec curTime;
+    getRealTime(curTime, flags);
+    return formatTime(curTime, buf, len, flags);
+}
+
+void Utils::getRealTime(struct timespec& curTime, int32_t flags) {
+    clock_gettime((flags & TF_COARSE_CLOCK) ? CLOCK_REALTIME_COARSE : CLOCK_REALTIME, &curTime);
+}
+
+size_t Utils::formatTime(const struct timespec& curTime, char* buf, size_t len, int32_t flags) {
+    SecondTextCache& cache = tlsSecondCache;
+    if (cache.second != curTime.tv_sec) {
+        struct tm localTime;
+        localtime_r(&curTime.tv_sec, &localTime);
+        strftime(cache.text, sizeof(cache.text), "%Y-%m-%d %H:%M:%S", &localTime);
+        cache.second = curTime.tv_sec;
+    }
+
+    char date[kSystemTimeMaxLen];
+    memcpy(date, cache.text, 19);
+    date[19] = '.';
+    uint32_t fraction = 0;
+    int32_t digits = 0;
+    if (flags & TF_WITH_USEC) {
+        fraction = (uint32_t)(curTime.tv_nsec / 1000);
+        digits = 6;
+    } else {
+        fraction = (uint32_t)(curTime.tv_nsec / 1000000);
+        digits = 3;
+    }
+    for (int32_t i = digits; i > 0; --i) {
+        date[19 + i] = (char)('0' + fraction % 10);
+        fraction /= 10;
+    }
+
+    size_t dateLen = 20 + digits;
+    if (dateLen > len) {
+        dateLen = len;
+    }
+    memcpy(buf, date, dateLen);
+    return dateLen;
 }
 
 const std::string Utils::getCurrentSystemDate() {
     struct timeval curTime;
     gettimeofday(&curTime, NULL);
+    struct tm localTime;
+    localtime_r(&curTime.tv_sec, &localTime);
     char date[100] = {0};
-    strftime(date, sizeof(date), "%Y-%m-%d", localtime(&curTime.tv_sec));
+    strftime(date, sizeof(date), "%Y-%m-%d", &localTime);
     return std::string(date);
 }
 
@@ -119,19 +171,38 @@ bool Utils::mkdirRecursive(const std::string path) {
     return isSucc;
 }
 
-void Utils::getDirFiles(std::string path, std::vector<std::string>& res) {
+void Utils::getDirFiles(std::string path, std::vector<std::string>& res,
+                        const std::string& prefix) {
     res.clear();
-    if (access(path.c_str(), 0) != 0) {
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
         return;
     }
-    DIR* dir = opendir(path.c_str());
     struct dirent* ptr;
     while ((ptr = readdir(dir)) != NULL) {
+        if (0 != strncmp(ptr->d_name, prefix.c_str(), prefix.size())) {
+            continue;
+        }
         res.push_back(std::string(ptr->d_name));
     }
     closedir(dir);
 }
 
+uint64_t Utils::getRandomSeed() {
+    uint64_t seed = 0;
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        ssize_t ret = read(fd, &seed, sizeof(seed));
+        close(fd);
+        if (ret == (ssize_t)sizeof(seed)) {
+            return seed;
+        }
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec ^ ((uint64_t)getpid() << 16);
+}
+
 bool Utils::isDigit(const std::string num) {
     for (size_t i = 0; i < num.size(); ++i) {
         if (!isdigit(num[i])) {
@@ -34,6 +34,11 @@ typedef unsigned short WORD;
 #include <stdio.h>
 #include "zip.h"
 #endif
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 
 // THIS FILE is almost entirely based upon code by info-zip.
@@ -210,6 +215,7 @@ typedef unsigned IPos; // A Pos is an index in the character window. Pos is used
 #define ZIP_FILENAME 2
 #define ZIP_MEMORY   3
 #define ZIP_FOLDER   4
+#define ZIP_STRING   5
 
 
 
@@ -633,7 +639,7 @@ struct TState
 // some windows<->linux portability things
 #ifdef ZIP_STD
 void filetime2dosdatetime(const FILETIME ft, WORD *dosdate, WORD *dostime)
-{ struct tm *st=gmtime(&ft);
+{ struct tm tmbuf; struct tm *st=gmtime_r(&ft,&tmbuf); // reentrant, zips may be built on several threads
   *dosdate = (ush)(((st->tm_year+1900 -1980)&0x7f) << 9);
   *dosdate |= (ush)((st->tm_mon&0xf) << 5);
   *dosdate |= (ush)((st->tm_mday&0x1f));
@@ -799,6 +805,7 @@ void send_bits      (TState &state, int value, int length);
 unsigned bi_reverse (unsigned code, int len);
 void bi_windup      (TState &state);
 void copy_block     (TState &state,char *buf, unsigned len, int header);
+ulg  sync_flush     (TState &state);
 
 
 #define send_code(state, c, tree) send_bits(state, tree[c].fc.code, tree[c].dl.len)
@@ -1633,6 +1640,20 @@ void copy_block(TState &state, char *block, unsigned len, int header)
     state.bs.bits_sent += (ulg)len<<3;
 }
 
+/* ===========================================================================
+ * Align the output on a byte boundary with an empty stored block, without
+ * ending the data (zlib's Z_SYNC_FLUSH), so that the deflate output of the
+ * following input can be appended to it. Return the compressed length.
+ */
+ulg sync_flush(TState &state)
+{
+    send_bits(state,(STORED_BLOCK<<1),3);
+    state.ts.cmpr_bytelen += ((state.ts.cmpr_len_bits + 3 + 7) >> 3) + 4;
+    state.ts.cmpr_len_bits = 0L;
+    copy_block(state,(char*)NULL,0,1);
+    return state.ts.cmpr_bytelen;
+}
+
 
 
 
@@ -1645,7 +1666,7 @@ void copy_block(TState &state, char *block, unsigned len, int header)
  */
 
 void fill_window  (TState &state);
-ulg deflate_fast  (TState &state);
+ulg deflate_fast  (TState &state, int eof);
 
 int  longest_match (TState &state,IPos cur_match);
 
@@ -1679,10 +1700,13 @@ int  longest_match (TState &state,IPos cur_match);
  *    window_size is sufficient to contain the whole input file plus
  *    MIN_LOOKAHEAD bytes (to avoid referencing memory beyond the end
  *    of window[] when looking for matches towards the end).
+ * If dictlen > 0, the last WSIZE bytes of dict are a preset dictionary: they
+ * are hashed so that the input can refer back to them, but are not output.
  */
-void lm_init (TState &state, int pack_level, ush *flags)
+void lm_init (TState &state, int pack_level, ush *flags, const uch *dict, unsigned dictlen)
 {
     register unsigned j;
+    IPos hash_head;
 
     Assert(state,pack_level>=1 && pack_level<=8,"bad pack level");
 
@@ -1714,12 +1738,17 @@ void lm_init (TState &state, int pack_level, ush *flags)
     }
     /* ??? reduce max_chain_length for binary files */
 
-    state.ds.strstart = 0;
-    state.ds.block_start = 0L;
+    if (dictlen > WSIZE) {
+        dict += dictlen - WSIZE;
+        dictlen = WSIZE;
+    }
+    if (dictlen > 0) memcpy(state.ds.window, dict, dictlen);
+    state.ds.strstart = dictlen;
+    state.ds.block_start = (long)dictlen;
 
     j = WSIZE;
     j <<= 1; // Can read 64K in one step
-    state.ds.lookahead = state.readfunc(state, (char*)state.ds.window, j);
+    state.ds.lookahead = state.readfunc(state, (char*)state.ds.window + dictlen, j - dictlen);
 
     if (state.ds.lookahead == 0 || state.ds.lookahead == (unsigned)EOF) {
        state.ds.eofile = 1, state.ds.lookahead = 0;
@@ -1736,6 +1765,9 @@ void lm_init (TState &state, int pack_level, ush *flags)
     /* If lookahead < MIN_MATCH, ins_h is garbage, but this is
      * not important since only literal bytes will be emitted.
      */
+    for (j=0; j<dictlen && j+MIN_MATCH<=dictlen+state.ds.lookahead; j++) {
+        INSERT_STRING(j, hash_head);
+    }
 }
 
 
@@ -1940,7 +1972,7 @@ void fill_window(TState &state)
  * new strings in the dictionary only for unmatched strings or for short
  * matches. It is used only for the fast compression options.
  */
-ulg deflate_fast(TState &state)
+ulg deflate_fast(TState &state, int eof)
 {
     IPos hash_head = NIL;       /* head of the hash chain */
     int flush;                  /* set if current block must be flushed */
@@ -2013,6 +2045,10 @@ ulg deflate_fast(TState &state)
          */
         if (state.ds.lookahead < MIN_LOOKAHEAD) fill_window(state);
     }
+    if (!eof) {
+        FLUSH_BLOCK(state,0);
+        return sync_flush(state);
+    }
     return FLUSH_BLOCK(state,1); /* eof */
 }
 
@@ -2021,7 +2057,7 @@ ulg deflate_fast(TState &state)
  * evaluation for matches: a match is finally adopted only if there is
  * no better match at the next window position.
  */
-ulg deflate(TState &state)
+ulg deflate(TState &state, int eof)
 {
     IPos hash_head = NIL;       /* head of hash chain */
     IPos prev_match;            /* previous match */
@@ -2029,7 +2065,7 @@ ulg deflate(TState &state)
     int match_available = 0;    /* set if previous match exists */
     register unsigned match_length = MIN_MATCH-1; /* length of best match */
 
-    if (state.level <= 3) return deflate_fast(state); /* optimized for speed */
+    if (state.level <= 3) return deflate_fast(state,eof); /* optimized for speed */
 
     /* Process the input block. */
     while (state.ds.lookahead != 0) {
@@ -2122,6 +2158,10 @@ ulg deflate(TState &state)
     }
     if (match_available) ct_tally (state,0, state.ds.window[state.ds.strstart-1]);
 
+    if (!eof) {
+        FLUSH_BLOCK(state,0);
+        return sync_flush(state);
+    }
     return FLUSH_BLOCK(state,1); /* eof */
 }
 
@@ -2281,6 +2321,36 @@ ulg crc32(ulg crc, const uch *buf, extent len)
   return crc ^ 0xffffffffL;  // (instead of ~c for 64-bit machines)
 }
 
+// crc32_combine returns the crc of A followed by B, given crc1=crc32(A),
+// crc2=crc32(B) and len2, the length of B; adapted from zlib. Appending len2
+// zero bytes to A is a linear operation over GF(2), applied to crc1 by
+// repeatedly squaring the matrix of a one-bit shift.
+ulg gf2_matrix_times(const ulg *mat, ulg vec)
+{ ulg sum=0;
+  while (vec) {if (vec&1) sum^=*mat; vec>>=1; mat++;}
+  return sum;
+}
+void gf2_matrix_square(ulg *square, const ulg *mat)
+{ for (int n=0; n<32; n++) square[n]=gf2_matrix_times(mat,mat[n]);
+}
+ulg crc32_combine(ulg crc1, ulg crc2, ulg len2)
+{ if (len2==0) return crc1;
+  ulg even[32], odd[32];             // even- and odd-power-of-two zeros operators
+  odd[0]=0xedb88320L;                // the operator for one zero bit
+  ulg row=1; for (int n=1; n<32; n++) {odd[n]=row; row<<=1;}
+  gf2_matrix_square(even,odd);       // two zero bits
+  gf2_matrix_square(odd,even);       // four zero bits
+  do
+  { gf2_matrix_square(even,odd);     // the first square gives one zero byte
+    if (len2&1) crc1=gf2_matrix_times(even,crc1);
+    len2>>=1; if (len2==0) break;
+    gf2_matrix_square(odd,even);
+    if (len2&1) crc1=gf2_matrix_times(odd,crc1);
+    len2>>=1;
+  } while (len2!=0);
+  return crc1^crc2;
+}
+
 
 void update_keys(unsigned long *keys, char c)
 { keys[0] = CRC32(keys[0],c);
@@ -2337,10 +2407,106 @@ bool HasZipSuffix(const TCHAR *fn)
 
 
 
+#define ZIP_BLOCK_SIZE (256*1024)  // input per block when deflating on several threads
+#define ZIP_BLOCK_MIN  (1024*1024) // smaller entries aren't worth splitting
+
+// One block of an entry, deflated on its own like pigz does: the input is
+// preceded by (up to) the last WSIZE bytes before it, used as the preset
+// dictionary, and the output ends with a sync flush instead of the last-block
+// bit, so that the outputs of all blocks concatenate into one deflate stream.
+struct TDeflateJob
+{ std::string in;   // dictionary followed by the block
+  unsigned dictlen; // how much of in is dictionary
+  unsigned pos;     // how much of the block the deflater has read
+  std::string out;  // deflate data of the block
+  ulg crc;          // crc32 of the block
+  bool done, failed;
+};
+
+// The worker threads of a zip, created with its first large entry. Each one
+// has its own TState, since the 500k object can't be shared.
+class TDeflatePool
+{ public:
+  TDeflatePool(unsigned int n) : stop(false)
+  { for (unsigned int i=0; i<n; i++) threads.push_back(std::thread(&TDeflatePool::run,this));
+  }
+  ~TDeflatePool()
+  { {std::lock_guard<std::mutex> lock(mtx); stop=true;}
+    cond.notify_all();
+    for (size_t i=0; i<threads.size(); i++) threads[i].join();
+  }
+  void push(TDeflateJob *job)
+  { {std::lock_guard<std::mutex> lock(mtx); jobs.push_back(job);}
+    cond.notify_one();
+  }
+  void wait(TDeflateJob *job)
+  { std::unique_lock<std::mutex> lock(mtx);
+    donecond.wait(lock,[job]() {return job->done;});
+  }
+
+  private:
+  void run()
+  { TState *state=new TState();
+    std::unique_lock<std::mutex> lock(mtx);
+    for (;;)
+    { cond.wait(lock,[this]() {return stop || !jobs.empty();});
+      if (jobs.empty()) break;
+      TDeflateJob *job=jobs.front(); jobs.pop_front();
+      lock.unlock();
+      deflate_job(*state,job);
+      lock.lock();
+      job->done=true;
+      donecond.notify_all();
+    }
+    lock.unlock();
+    delete state;
+  }
+  static void deflate_job(TState &state, TDeflateJob *job)
+  { char buf[16384];
+    const char *data=job->in.data()+job->dictlen; unsigned len=(unsigned)job->in.size()-job->dictlen;
+    job->crc=crc32(CRCVAL_INITIAL,(const uch*)data,len);
+    job->pos=0;
+    state.param=job; state.level=8; state.seekable=false; state.err=NULL;
+    state.readfunc=sread; state.flush_outbuf=sflush;
+    state.ts.static_dtree[0].dl.len = 0;
+    state.ds.window_size=0;
+    ush att=(ush)BINARY, flg=0;
+    bi_init(state,buf,sizeof(buf),1);
+    ct_init(state,&att);
+    lm_init(state,state.level,&flg,(const uch*)job->in.data(),job->dictlen);
+    deflate(state,0);
+    job->failed = (state.err!=NULL);
+  }
+  static unsigned sread(TState &s,char *buf,unsigned size)
+  { TDeflateJob *job=(TDeflateJob*)s.param;
+    unsigned len=(unsigned)job->in.size()-job->dictlen;
+    if (job->pos>=len) return 0;
+    if (size>len-job->pos) size=len-job->pos;
+    memcpy(buf,job->in.data()+job->dictlen+job->pos,size);
+    job->pos+=size;
+    return size;
+  }
+  static unsigned sflush(void *param,const char *buf, unsigned *size)
+  { if (*size==0) return 0;
+    TDeflateJob *job=(TDeflateJob*)param;
+    job->out.append(buf,*size);
+    unsigned writ=*size; *size=0;
+    return writ;
+  }
+
+  std::mutex mtx;
+  std::condition_variable cond, donecond;
+  std::deque<TDeflateJob*> jobs;
+  bool stop;
+  std::vector<std::thread> threads;
+};
+
+
+
 class TZip
 { public:
-  TZip(const char *pwd) : hfout(0),mustclosehfout(false),hmapout(0),zfis(0),obuf(0),hfin(0),writ(0),oerr(false),hasputcen(false),ooffset(0),encwriting(false),encbuf(0),password(0), state(0) {if (pwd!=0 && *pwd!=0) {password=new char[strlen(pwd)+1]; strcpy(password,pwd);}}
-  ~TZip() {if (state!=0) delete state; state=0; if (encbuf!=0) delete[] encbuf; encbuf=0; if (password!=0) delete[] password; password=0;}
+  TZip(const char *pwd) : hfout(0),mustclosehfout(false),hmapout(0),zfis(0),obuf(0),ostr(0),hfin(0),writ(0),oerr(false),hasputcen(false),ooffset(0),encwriting(false),encbuf(0),password(0), state(0),threads(1),pool(0) {if (pwd!=0 && *pwd!=0) {password=new char[strlen(pwd)+1]; strcpy(password,pwd);}}
+  ~TZip() {if (pool!=0) delete pool; pool=0; if (state!=0) delete state; state=0; if (encbuf!=0) delete[] encbuf; encbuf=0; if (password!=0) delete[] password; password=0;}
 
   // These variables say about the file we're writing into
   // We can write to pipe, file-by-handle, file-by-name, memory-to-memmapfile
@@ -2353,6 +2519,7 @@ class TZip
   unsigned writ;            // how far have we written. This is maintained by Add, not write(), to avoid confusion over seeks
   bool ocanseek;            // can we seek?
   char *obuf;               // this is where we've locked mmap to view.
+  std::string *ostr;        // if valid, obuf lives inside this string, which grows as needed
   unsigned int opos;        // current pos in the mmap
   unsigned int mapsize;     // the size of the map we created
   bool hasputcen;           // have we yet placed the central directory?
@@ -2363,12 +2530,15 @@ class TZip
   //
   TZipFileInfo *zfis;       // each file gets added onto this list, for writing the table at the end
   TState *state;            // we use just one state object per zip, because it's big (500k)
+  unsigned int threads;     // if more than 1, large items are deflated in blocks on this many threads
+  TDeflatePool *pool;       // and these are the threads, created when first needed
 
   ZRESULT Create(void *z,unsigned int len,DWORD flags);
   static unsigned sflush(void *param,const char *buf, unsigned *size);
   static unsigned swrite(void *param,const char *buf, unsigned size);
   unsigned int write(const char *buf,unsigned int size);
   bool oseek(unsigned int pos);
+  bool ogrow(unsigned int need);
   ZRESULT GetMemory(void **pbuf, unsigned long *plen);
   ZRESULT Close();
 
@@ -2392,12 +2562,16 @@ class TZip
   ZRESULT open_dir();
   static unsigned sread(TState &s,char *buf,unsigned size);
   unsigned read(char *buf, unsigned size);
+  unsigned iread(char *buf, unsigned size);
   ZRESULT iclose();
 
   ZRESULT ideflate(TZipFileInfo *zfi);
+  ZRESULT ideflate_blocks(TZipFileInfo *zfi);
   ZRESULT istore();
 
   ZRESULT Add(const TCHAR *odstzn, void *src,unsigned int len, DWORD flags);
+  ZRESULT AddRaw(const TCHAR *odstzn, const ZIPRAW *raw, const void *data);
+  ZRESULT GetRaw(int index, ZIPRAW *raw);
   ZRESULT AddCentral();
 
 };
@@ -2454,6 +2628,15 @@ ZRESULT TZip::Create(void *z,unsigned int len,DWORD flags)
     opos=0; mapsize=size;
     return ZR_OK;
   }
+  else if (flags==ZIP_STRING)
+  { if (z==0) return ZR_ARGS;
+    ostr=(std::string*)z;
+    if (ostr->size()<16384) ostr->resize(16384);
+    obuf=&(*ostr)[0];
+    ocanseek=true;
+    opos=0; mapsize=(unsigned int)ostr->size();
+    return ZR_OK;
+  }
   else return ZR_ARGS;
 }
 
@@ -2480,7 +2663,7 @@ unsigned int TZip::write(const char *buf,unsigned int size)
     srcbuf=encbuf;
   }
   if (obuf!=0)
-  { if (opos+size>=mapsize) {oerr=ZR_MEMSIZE; return 0;}
+  { if (opos+size>=mapsize && !ogrow(opos+size+1)) {oerr=ZR_MEMSIZE; return 0;}
     memcpy(obuf+opos, srcbuf, size);
     opos+=size;
     return size;
@@ -2500,7 +2683,7 @@ unsigned int TZip::write(const char *buf,unsigned int size)
 bool TZip::oseek(unsigned int pos)
 { if (!ocanseek) {oerr=ZR_SEEK; return false;}
   if (obuf!=0)
-  { if (pos>=mapsize) {oerr=ZR_MEMSIZE; return false;}
+  { if (pos>=mapsize && !ogrow(pos+1)) {oerr=ZR_MEMSIZE; return false;}
     opos=pos;
     return true;
   }
@@ -2516,11 +2699,21 @@ bool TZip::oseek(unsigned int pos)
   oerr=ZR_NOTINITED; return 0;
 }
 
+bool TZip::ogrow(unsigned int need)
+{ if (ostr==0 || need==0) return false; // need==0: the size wrapped around
+  size_t size=ostr->size(); while (size<need) size*=2;
+  if (size>0xFFFFFFFF) size=0xFFFFFFFF;
+  ostr->resize(size);
+  obuf=&(*ostr)[0]; mapsize=(unsigned int)size;
+  return true;
+}
+
 ZRESULT TZip::GetMemory(void **pbuf, unsigned long *plen)
 { // When the user calls GetMemory, they're presumably at the end
   // of all their adding. In any case, we have to add the central
   // directory now, otherwise the memory we tell them won't be complete.
   if (!hasputcen) AddCentral(); hasputcen=true;
+  if (ostr!=0) {ostr->resize(writ); obuf=&(*ostr)[0]; mapsize=writ;}
   if (pbuf!=NULL) *pbuf=(void*)obuf;
   if (plen!=NULL) *plen=writ;
   if (obuf==NULL) return ZR_NOTMMAP;
@@ -2531,6 +2724,7 @@ ZRESULT TZip::Close()
 { // if the directory hadn't already been added through a call to GetMemory,
   // then we do it now
   ZRESULT res=ZR_OK; if (!hasputcen) res=AddCentral(); hasputcen=true;
+  if (ostr!=0) {ostr->resize(writ); obuf=0; ostr=0;}
 #ifdef ZIP_STD
   if (hfout!=0 && mustclosehfout) fclose(hfout); hfout=0; mustclosehfout=false;
 #else
@@ -2627,14 +2821,21 @@ unsigned TZip::sread(TState &s,char *buf,unsigned size)
 }
 
 unsigned TZip::read(char *buf, unsigned size)
-{ if (bufin!=0)
+{ unsigned red = iread(buf,size);
+  if (red==0 || red==(unsigned)EOF) return red;
+  ired += red;
+  crc = crc32(crc, (uch*)buf, red);
+  return red;
+}
+
+unsigned TZip::iread(char *buf, unsigned size)
+{ // just the reading part of read(), for callers that keep ired and crc themselves
+  if (bufin!=0)
   { if (posin>=lenin) return 0; // end of input
     ulg red = lenin-posin;
     if (red>size) red=size;
     memcpy(buf, bufin+posin, red);
     posin += red;
-    ired += red;
-    crc = crc32(crc, (uch*)buf, red);
     return red;
   }
   else if (hfin!=0)
@@ -2646,8 +2847,6 @@ unsigned TZip::read(char *buf, unsigned size)
     BOOL ok = ReadFile(hfin,buf,size,&red,NULL);
     if (!ok) return 0;
 #endif
-    ired += red;
-    crc = crc32(crc, (uch*)buf, red);
     return red;
   }
   else {oerr=ZR_NOTINITED; return 0;}
@@ -2669,7 +2868,8 @@ ZRESULT TZip::iclose()
 
 
 ZRESULT TZip::ideflate(TZipFileInfo *zfi)
-{ if (state==0) state=new TState();
+{ if (threads>1 && isize>=ZIP_BLOCK_MIN) return ideflate_blocks(zfi);
+  if (state==0) state=new TState();
   // It's a very big object! 500k! We allocate it on the heap, because PocketPC's
   // stack breaks if we try to put it all on the stack. It will be deleted lazily
   state->err=0;
@@ -2683,13 +2883,61 @@ ZRESULT TZip::ideflate(TZipFileInfo *zfi)
   //
   bi_init(*state,buf, sizeof(buf), 1); // it used to be just 1024-size, not 16384 as here
   ct_init(*state,&zfi->att);
-  lm_init(*state,state->level, &zfi->flg);
-  ulg sz = deflate(*state);
+  lm_init(*state,state->level, &zfi->flg, NULL, 0);
+  ulg sz = deflate(*state,1);
   csize=sz;
   ZRESULT r=ZR_OK; if (state->err!=NULL) r=ZR_FLATE;
   return r;
 }
 
+ZRESULT TZip::ideflate_blocks(TZipFileInfo *zfi)
+{ // The main thread reads the input block by block and hands the blocks to the
+  // pool, then writes their outputs in order as they complete. At most two
+  // blocks per thread are in flight, which bounds the memory used.
+  if (pool==0) pool=new TDeflatePool(threads);
+  std::deque<TDeflateJob*> inflight;
+  std::string dict;
+  bool eof=false; ZRESULT r=ZR_OK;
+  csize=0;
+  for (;;)
+  { while (!eof && inflight.size()<2*threads)
+    { TDeflateJob *job=new TDeflateJob();
+      job->dictlen=(unsigned)dict.size(); job->done=false; job->failed=false;
+      job->in=dict; job->in.resize(dict.size()+ZIP_BLOCK_SIZE);
+      unsigned len=0;
+      while (len<ZIP_BLOCK_SIZE)
+      { unsigned red=iread(&job->in[job->dictlen+len],ZIP_BLOCK_SIZE-len);
+        if (red==0 || red==(unsigned)EOF) {eof=true; break;}
+        len+=red;
+      }
+      if (len==0) {delete job; break;}
+      job->in.resize(job->dictlen+len);
+      ired+=len;
+      // the last WSIZE bytes so far are the next block's dictionary
+      size_t keep = job->in.size()<WSIZE ? job->in.size() : WSIZE;
+      dict.assign(job->in,job->in.size()-keep,keep);
+      inflight.push_back(job); pool->push(job);
+    }
+    if (inflight.empty()) break;
+    TDeflateJob *job=inflight.front(); inflight.pop_front();
+    pool->wait(job);
+    if (job->failed) {r=ZR_FLATE; eof=true;} // and drain the blocks still in flight
+    if (r==ZR_OK)
+    { crc=crc32_combine(crc,job->crc,job->in.size()-job->dictlen);
+      write(job->out.data(),(unsigned int)job->out.size());
+      csize+=job->out.size();
+    }
+    delete job;
+  }
+  if (r!=ZR_OK) return r;
+  // every block ended with a sync flush, so end the stream with an empty
+  // last block (static trees, just the end-of-block code)
+  const char last[2]={3,0};
+  write(last,2); csize+=2;
+  zfi->flg |= SLOW; // as lm_init sets for level 8
+  return ZR_OK;
+}
+
 ZRESULT TZip::istore()
 { ulg size=0;
   for (;;)
@@ -2856,6 +3104,108 @@ ZRESULT TZip::Add(const TCHAR *odstzn, void *src,unsigned int len, DWORD flags)
   return ZR_OK;
 }
 
+ZRESULT TZip::AddRaw(const TCHAR *odstzn, const ZIPRAW *raw, const void *data)
+{ if (oerr) return ZR_FAILED;
+  if (hasputcen) return ZR_ENDED;
+  if (raw==0 || (data==0 && raw->csize!=0)) return ZR_ARGS;
+  if (raw->method!=STORE && raw->method!=DEFLATE) return ZR_ARGS;
+  // the data was compressed without our keys, so it can't go into an encrypted zip
+  if (password!=0) return ZR_ARGS;
+
+  TCHAR dstzn[MAX_PATH]; _tcsncpy(dstzn,odstzn,MAX_PATH); dstzn[MAX_PATH-1]=0;
+  if (*dstzn==0) return ZR_ARGS;
+  TCHAR *d=dstzn; while (*d!=0) {if (*d=='\\') *d='/'; d++;}
+
+  // Everything is known up front, so the local header is written just once
+  TZipFileInfo zfi; zfi.nxt=NULL;
+  strcpy(zfi.name,"");
+#ifdef UNICODE
+  WideCharToMultiByte(CP_UTF8,0,dstzn,-1,zfi.iname,MAX_PATH,0,0);
+#else
+  strncpy(zfi.iname,dstzn,MAX_PATH); zfi.iname[MAX_PATH-1]=0;
+#endif
+  zfi.nam=strlen(zfi.iname);
+  strcpy(zfi.zname,"");
+  zfi.extra=NULL; zfi.ext=0;
+  zfi.cextra=NULL; zfi.cext=0;
+  zfi.comment=NULL; zfi.com=0;
+  zfi.mark = 1;
+  zfi.dosflag = 0;
+  zfi.att = (ush)BINARY;
+  zfi.vem = (ush)0xB17;
+  zfi.ver = (ush)20;
+  zfi.tim = raw->timestamp;
+  zfi.crc = raw->crc;
+  zfi.flg = (ush)(raw->flag & ~9); // no extended local header, no encryption
+  zfi.lflg = zfi.flg;
+  zfi.how = raw->method;
+  zfi.siz = raw->csize;
+  zfi.len = raw->usize;
+  zfi.dsk = 0;
+  zfi.atx = raw->attr;
+  zfi.off = writ+ooffset;
+
+  char xloc[EB_L_UT_SIZE]; zfi.extra=xloc;  zfi.ext=EB_L_UT_SIZE;
+  char xcen[EB_C_UT_SIZE]; zfi.cextra=xcen; zfi.cext=EB_C_UT_SIZE;
+  xloc[0]  = 'U';
+  xloc[1]  = 'T';
+  xloc[2]  = EB_UT_LEN(3);
+  xloc[3]  = 0;
+  xloc[4]  = EB_UT_FL_MTIME | EB_UT_FL_ATIME | EB_UT_FL_CTIME;
+  for (int i=0; i<3; i++)
+  { xloc[5+i*4] = (char)(raw->mtime);
+    xloc[6+i*4] = (char)(raw->mtime >> 8);
+    xloc[7+i*4] = (char)(raw->mtime >> 16);
+    xloc[8+i*4] = (char)(raw->mtime >> 24);
+  }
+  memcpy(zfi.cextra,zfi.extra,EB_C_UT_SIZE);
+  zfi.cextra[EB_LEN] = EB_UT_LEN(1);
+
+  int r = putlocal(&zfi,swrite,this);
+  if (r!=ZE_OK) return ZR_WRITE;
+  writ += 4 + LOCHEAD + (unsigned int)zfi.nam + (unsigned int)zfi.ext;
+  if (oerr!=ZR_OK) return oerr;
+
+  // copy the compressed data as it is
+  const char *src=(const char*)data;
+  for (ulg done=0; done<raw->csize; )
+  { unsigned int chunk = (unsigned int)(raw->csize-done); if (chunk>(1<<20)) chunk=1<<20;
+    if (write(src+done,chunk)!=chunk) return oerr!=ZR_OK ? oerr : ZR_WRITE;
+    done += chunk;
+  }
+  writ += raw->csize;
+  if (oerr!=ZR_OK) return oerr;
+
+  char *cextra = new char[zfi.cext]; memcpy(cextra,zfi.cextra,zfi.cext); zfi.cextra=cextra;
+  TZipFileInfo *pzfi = new TZipFileInfo; memcpy(pzfi,&zfi,sizeof(zfi));
+  if (zfis==NULL) zfis=pzfi;
+  else {TZipFileInfo *z=zfis; while (z->nxt!=NULL) z=z->nxt; z->nxt=pzfi;}
+  return ZR_OK;
+}
+
+ZRESULT TZip::GetRaw(int index, ZIPRAW *raw)
+{ if (raw==0 || index<0) return ZR_ARGS;
+  if (hasputcen) return ZR_ENDED;
+  TZipFileInfo *z=zfis; for (int i=0; z!=NULL && i<index; i++) z=z->nxt;
+  if (z==NULL) return ZR_NOTFOUND;
+  // encrypted or pipe-written entries can't be copied with ZipAddRaw
+  if ((z->flg & 9)!=0) return ZR_NOCHANGE;
+  raw->crc = z->crc;
+  raw->csize = z->siz;
+  raw->usize = z->len;
+  raw->method = z->how;
+  raw->flag = z->flg;
+  raw->attr = z->atx;
+  raw->timestamp = z->tim;
+  raw->mtime = 0;
+  if (z->cextra!=0 && z->cext>=EB_C_UT_SIZE)
+  { const uch *t=(const uch*)z->cextra+5;
+    raw->mtime = (ulg)t[0] | ((ulg)t[1]<<8) | ((ulg)t[2]<<16) | ((ulg)t[3]<<24);
+  }
+  raw->offset = z->off + 4 + LOCHEAD + z->nam + z->ext;
+  return ZR_OK;
+}
+
 ZRESULT TZip::AddCentral()
 { // write central directory
   int numentries = 0;
@@ -2891,7 +3241,7 @@ ZRESULT TZip::AddCentral()
 
 
 
-ZRESULT lasterrorZ=ZR_OK;
+thread_local ZRESULT lasterrorZ=ZR_OK; // per thread, zips may be built on several threads at once
 
 unsigned int FormatZipMessageZ(ZRESULT code, char *buf,unsigned int len)
 { if (code==ZR_RECENT) code=lasterrorZ;
@@ -2944,6 +3294,7 @@ HZIP CreateZipInternal(void *z,unsigned int len,DWORD flags, const char *passwor
 HZIP CreateZipHandle(HANDLE h, const char *password) {return CreateZipInternal(h,0,ZIP_HANDLE,password);}
 HZIP CreateZip(const TCHAR *fn, const char *password) {return CreateZipInternal((void*)fn,0,ZIP_FILENAME,password);}
 HZIP CreateZip(void *z,unsigned int len, const char *password) {return CreateZipInternal(z,len,ZIP_MEMORY,password);}
+HZIP CreateZip(std::string *buf, const char *password) {return CreateZipInternal(buf,0,ZIP_STRING,password);}
 
 
 ZRESULT ZipAddInternal(HZIP hz,const TCHAR *dstzn, void *src,unsigned int len, DWORD flags)
@@ -2960,7 +3311,36 @@ ZRESULT ZipAddHandle(HZIP hz,const TCHAR *dstzn, HANDLE h) {return ZipAddInterna
 ZRESULT ZipAddHandle(HZIP hz,const TCHAR *dstzn, HANDLE h, unsigned int len) {return ZipAddInternal(hz,dstzn,h,len,ZIP_HANDLE);}
 ZRESULT ZipAddFolder(HZIP hz,const TCHAR *dstzn) {return ZipAddInternal(hz,dstzn,0,0,ZIP_FOLDER);}
 
+ZRESULT ZipAddRaw(HZIP hz,const TCHAR *dstzn, const ZIPRAW *raw, const void *data)
+{ if (hz==0) {lasterrorZ=ZR_ARGS;return ZR_ARGS;}
+  TZipHandleData *han = (TZipHandleData*)hz;
+  if (han->flag!=2) {lasterrorZ=ZR_ZMODE;return ZR_ZMODE;}
+  TZip *zip = han->zip;
+  lasterrorZ = zip->AddRaw(dstzn,raw,data);
+  return lasterrorZ;
+}
 
+ZRESULT ZipGetRaw(HZIP hz, int index, ZIPRAW *raw)
+{ if (hz==0) {lasterrorZ=ZR_ARGS;return ZR_ARGS;}
+  TZipHandleData *han = (TZipHandleData*)hz;
+  if (han->flag!=2) {lasterrorZ=ZR_ZMODE;return ZR_ZMODE;}
+  TZip *zip = han->zip;
+  lasterrorZ = zip->GetRaw(index,raw);
+  return lasterrorZ;
+}
+
+
+
+ZRESULT ZipSetThreads(HZIP hz, unsigned int threads)
+{ if (hz==0) {lasterrorZ=ZR_ARGS;return ZR_ARGS;}
+  TZipHandleData *han = (TZipHandleData*)hz;
+  if (han->flag!=2) {lasterrorZ=ZR_ZMODE;return ZR_ZMODE;}
+  TZip *zip = han->zip;
+  if (zip->pool!=0) {lasterrorZ=ZR_ARGS;return ZR_ARGS;} // the threads have already been started
+  zip->threads = threads>0 ? threads : 1;
+  lasterrorZ = ZR_OK;
+  return ZR_OK;
+}
 
 ZRESULT ZipGetMemory(HZIP hz, void **buf, unsigned long *len)
 { if (hz==0) {if (buf!=0) *buf=0; if (len!=0) *len=0; lasterrorZ=ZR_ARGS;return ZR_ARGS;}
@@ -1,6 +1,7 @@
 #ifndef _zip_H
 #define _zip_H
 //
+#include <string>
 #ifdef ZIP_STD
 #include <time.h>
 #define DECLARE_HANDLE(name) struct name##__ { int unused; }; typedef struct name##__ *name
@@ -33,12 +34,14 @@ typedef DWORD ZRESULT;
 HZIP CreateZip(const TCHAR *fn, const char *password);
 HZIP CreateZip(void *buf,unsigned int len, const char *password);
 HZIP CreateZipHandle(HANDLE h, const char *password);
+HZIP CreateZip(std::string *buf, const char *password);
 // CreateZip - call this to start the creation of a zip file.
 // As the zip is being created, it will be stored somewhere:
 // to a pipe:              CreateZipHandle(hpipe_write);
 // in a file (by handle):  CreateZipHandle(hfile);
 // in a file (by name):    CreateZip("c:\\test.zip");
 // in memory:              CreateZip(buf, len);
+// in a growing string:  CreateZip(&str, 0);
 // or in pagefile memory:  CreateZip(0, len);
 // The final case stores it in memory backed by the system paging file,
 // where the zip may not exceed len bytes. This is a bit friendlier than
@@ -47,6 +50,8 @@ HZIP CreateZipHandle(HANDLE h, const char *password);
 // large estimates of the maximum-size without too much worry.
 // As for the password, it lets you encrypt every file in the archive.
 // (This api doesn't support per-file encryption.)
+// With a string, the zip is written into it from the start and the string
+// grows as needed; ZipGetMemory and CloseZip cut it to the zip's length.
 // Note: because pipes don't allow random access, the structure of a zipfile
 // created into a pipe is slightly different from that created into a file
 // or memory. In particular, the compressed-size of the item cannot be
@@ -83,6 +88,41 @@ ZRESULT ZipAddFolder(HZIP hz,const TCHAR *dstzn);
 // compressed item itself, which in turn makes it easier when unzipping the
 // zipfile from a pipe.
 
+typedef struct
+{ unsigned long crc;        // crc32 of the original data
+  unsigned long csize;      // size of the compressed data
+  unsigned long usize;      // size of the original data
+  unsigned short method;    // 0=stored, 8=deflated
+  unsigned short flag;      // general purpose bit flag, e.g. the deflate level
+  unsigned long attr;       // external file attributes
+  unsigned long timestamp;  // dos date in the high word, dos time in the low word
+  unsigned long mtime;      // unix modification time
+  unsigned long offset;     // where the compressed data starts in the zipfile (ZipGetRaw)
+} ZIPRAW;
+// ZIPRAW - an item whose data is already compressed, so it can be copied
+// into another zip without being deflated again.
+
+ZRESULT ZipGetRaw(HZIP hz, int index, ZIPRAW *raw);
+ZRESULT ZipAddRaw(HZIP hz,const TCHAR *dstzn, const ZIPRAW *raw, const void *data);
+// ZipGetRaw - describes the index'th item added so far, including where its
+// compressed data lies inside the zipfile. Call it before CloseZip.
+// ZipAddRaw - adds an item from its compressed data, e.g. raw->csize bytes
+// read at raw->offset from a zipfile described by ZipGetRaw. The data is
+// copied as it is, without being inflated or checked. Neither function
+// works on password-protected zips.
+// e.g. copying an unchanged item from the old zip into the new one:
+//     ZIPRAW raw; ZipGetRaw(hzold,0,&raw);   // remembered before CloseZip(hzold)
+//     ... read raw.csize bytes at raw.offset from the old zipfile into buf
+//     ZipAddRaw(hznew,"file.log",&raw,buf);
+
+ZRESULT ZipSetThreads(HZIP hz, unsigned int threads);
+// ZipSetThreads - lets items of 1MB or more be deflated on this many threads.
+// Such an item is cut into 256KB blocks, each deflated with the 32KB before
+// it as dictionary, and the blocks are joined into one ordinary deflate
+// stream, so any unzipper can read it. It costs a few bytes per block.
+// The default is 1, i.e. everything is deflated on the calling thread.
+// Call it before adding the first large item.
+
 ZRESULT ZipGetMemory(HZIP hz, void **buf, unsigned long *len);
 // ZipGetMemory - If the zip was created in memory, via ZipCreate(0,len),
 // then this function will return information about that memory block.
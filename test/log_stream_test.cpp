@@ -0,0 +1,71 @@
+/***************************************************************************
+*
+* Copyright (c) 2020 jackszhang, All Rights Reserved
+*
+* @file    log_stream_test.cpp
+* @author  jackszhang
+* @date    2020/10/25
+* @brief   The test of log stream 流式日志与std::ostream的输出对比
+*
+**************************************************************************/
+
+#include <stdio.h>
+
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include "log_stream.hpp"
+
+using namespace dailycode;
+
+static int failedCnt = 0;
+
+// 同一组输出分别写入LogStream和std::ostringstream，结果应当一致
+#define EXPECT_SAME_AS_OSTREAM(exprs)                                                    \
+    do {                                                                                 \
+        LogStream ls;                                                                    \
+        std::ostringstream os;                                                           \
+        ls exprs;                                                                        \
+        os exprs;                                                                        \
+        std::string got(ls.data(), ls.size());                                           \
+        if (got != os.str()) {                                                           \
+            fprintf(stderr, "%s:%d [%s] got [%s] expect [%s]\n", __FILE__, __LINE__, #exprs, \
+                    got.c_str(), os.str().c_str());                                      \
+            failedCnt++;                                                                 \
+        }                                                                                \
+    } while (0)
+
+int main() {
+    // 没有操纵符时走直接转换
+    EXPECT_SAME_AS_OSTREAM(<< "a" << 1 << ' ' << -2L << ' ' << 3u << ' ' << 1.5 << ' ' << true);
+
+    // 进制
+    EXPECT_SAME_AS_OSTREAM(<< std::hex << 255 << ' ' << 255u << ' ' << (short)-1);
+    EXPECT_SAME_AS_OSTREAM(<< std::hex << 255 << std::dec << ' ' << 255);
+    EXPECT_SAME_AS_OSTREAM(<< std::oct << 8 << ' ' << std::showbase << std::hex << 255);
+    EXPECT_SAME_AS_OSTREAM(<< std::uppercase << std::hex << 0xabcdefULL);
+
+    // 宽度和填充，宽度只对下一项生效
+    EXPECT_SAME_AS_OSTREAM(<< std::setw(5) << 7 << '|' << 7);
+    EXPECT_SAME_AS_OSTREAM(<< std::setfill('0') << std::setw(4) << 42 << ' ' << std::setw(3) << 5);
+    EXPECT_SAME_AS_OSTREAM(<< std::left << std::setw(6) << "ab" << '|' << std::setw(4) << 1.5);
+    EXPECT_SAME_AS_OSTREAM(<< std::setw(8) << std::string("str") << '|');
+
+    // 精度和浮点格式
+    EXPECT_SAME_AS_OSTREAM(<< std::setprecision(3) << 3.14159 << ' ' << 2.0f);
+    EXPECT_SAME_AS_OSTREAM(<< std::fixed << std::setprecision(2) << 1.005 << ' ' << 10.0);
+    EXPECT_SAME_AS_OSTREAM(<< std::scientific << 12345.678);
+    EXPECT_SAME_AS_OSTREAM(<< std::setprecision(10) << 1.0L / 3);
+
+    // 其他
+    EXPECT_SAME_AS_OSTREAM(<< std::boolalpha << true << ' ' << false);
+    EXPECT_SAME_AS_OSTREAM(<< 1 << std::endl << 2);
+    EXPECT_SAME_AS_OSTREAM(<< "x" << std::hex << 'c' << 16 << "y");
+
+    if (failedCnt > 0) {
+        fprintf(stderr, "%d log stream cases failed\n", failedCnt);
+        return 1;
+    }
+    printf("all log stream cases passed\n");
+    return 0;
+}
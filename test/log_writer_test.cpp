@@ -0,0 +1,117 @@
+/***************************************************************************
+*
+* Copyright (c) 2020 jackszhang, All Rights Reserved
+*
+* @file    log_writer_test.cpp
+* @author  jackszhang
+* @date    2020/11/20
+* @brief   The test of log writer mmap写入在正常关闭和崩溃后重新打开时的文件内容
+*
+**************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <string>
+#include "log_writer.h"
+
+using namespace dailycode;
+
+#define kTestLogFile "./log_writer_test.log"
+
+static int failedCnt = 0;
+
+#define EXPECT_TRUE(cond)                                                               \
+    do {                                                                                \
+        if (!(cond)) {                                                                  \
+            fprintf(stderr, "%s:%d expect [%s] failed\n", __FILE__, __LINE__, #cond);   \
+            failedCnt++;                                                                \
+        }                                                                               \
+    } while (0)
+
+// 与LogFile一样以O_APPEND打开，按文件当前大小attach
+static int openLogFile(uint64_t& size) {
+    int fd = open(kTestLogFile, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st;
+    size = (fd >= 0 && 0 == fstat(fd, &st)) ? (uint64_t)st.st_size : 0;
+    return fd;
+}
+
+static std::string readLogFile() {
+    std::string content;
+    FILE* fp = fopen(kTestLogFile, "rb");
+    if (!fp) {
+        return content;
+    }
+    char buf[4096];
+    size_t len = 0;
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        content.append(buf, len);
+    }
+    fclose(fp);
+    return content;
+}
+
+// 正常attach、写入、detach，attach后的大小应为已写入的数据大小
+static void writeClean(const std::string& data, uint64_t maxSize, uint64_t expectOffset) {
+    uint64_t size = 0;
+    int fd = openLogFile(size);
+    std::shared_ptr<LogWriter> writer = LogWriter::create(LWM_MMAP, false);
+    EXPECT_TRUE(writer->attach(fd, size, maxSize));
+    EXPECT_TRUE(writer->offset() == expectOffset);
+    EXPECT_TRUE(writer->write(data.data(), data.size()));
+    writer->detach();
+    close(fd);
+}
+
+// 在子进程中写入后直接退出，不detach，模拟进程崩溃
+static void writeCrash(const std::string& data, uint64_t maxSize) {
+    pid_t pid = fork();
+    if (0 == pid) {
+        uint64_t size = 0;
+        int fd = openLogFile(size);
+        std::shared_ptr<LogWriter> writer = LogWriter::create(LWM_MMAP, false);
+        if (!writer->attach(fd, size, maxSize) || !writer->write(data.data(), data.size())) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    int status = -1;
+    waitpid(pid, &status, 0);
+    EXPECT_TRUE(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+}
+
+int main() {
+    unlink(kTestLogFile);
+
+    // 正常关闭的文件末尾的0是数据本身(如加密后的密文)，重新打开时不能截掉
+    std::string expect("ab\0\0\0", 5);
+    writeClean(expect, 0, 0);
+    writeClean(std::string("c\0", 2), 0, expect.size());
+    expect.append("c\0", 2);
+    EXPECT_TRUE(readLogFile() == expect);
+
+    // 连续崩溃，每次重新打开都找回真实大小，不残留旧标记
+    writeCrash("x\n", 0);
+    expect.append("x\n");
+    writeCrash("y\n", 0);
+    expect.append("y\n");
+    // 映射变大时旧标记在文件中间
+    writeCrash("z\n", 2 * 1024 * 1024);
+    expect.append("z\n");
+    writeClean("end\n", 0, expect.size());
+    expect.append("end\n");
+    EXPECT_TRUE(readLogFile() == expect);
+
+    unlink(kTestLogFile);
+    if (failedCnt > 0) {
+        fprintf(stderr, "%d log writer cases failed\n", failedCnt);
+        return 1;
+    }
+    printf("all log writer cases passed\n");
+    return 0;
+}
@@ -72,9 +72,10 @@ int main() {
     LOG_CONF_SET(LC_LOG_ENABLE_COMPRESS, 1);
     LOG_CONF_SET(LC_LOG_COMPRESS_INTERVAL, 60);
     LOG_CONF_SET(LC_LOG_NEED_ENCRYPTION,
-                 ET_NO_ENCRYPTION);  // ET_XOR_ENCRYPTION   ET_BLOWFISH_ENCRYPTION,
+                 ET_NO_ENCRYPTION);  // ET_XOR_ENCRYPTION   ET_BLOWFISH_ENCRYPTION   ET_AES_ENCRYPTION,
     LOG_SET_ENCRYPT_KEY(ET_XOR_ENCRYPTION, "xor123");
     LOG_SET_ENCRYPT_KEY(ET_BLOWFISH_ENCRYPTION, "fish245");
+    LOG_SET_ENCRYPT_KEY(ET_AES_ENCRYPTION, "aes1234567890abc");
     thread t1(threadFunc, 1);
     thread t2(threadFunc, 2);
     t1.join();
@@ -0,0 +1,367 @@
+/***************************************************************************
+*
+* Copyright (c) 2020 jackszhang, All Rights Reserved
+*
+* @file    log_decoder.cpp
+* @author  jackszhang
+* @date    2020/11/08
+* @brief   The interface of log decoder 离线解密并还原日志文件
+*
+**************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log_file.h"
+#include "utils.h"
+#include "xor.h"
+#include "blowfish.h"
+#include "aes.h"
+#include "unzip.h"
+
+using namespace dailycode;
+
+#define kDecodeWindowSize (64 * 1024 * 1024)  // 每轮并行解码的输入字节数
+#define kDecodePlainChunk (4 * 1024 * 1024)   // 明文区段按行切分后的最大长度
+#define kDecodeLevelChars "TIWE"              // 日志级别字符，按级别从低到高排列
+
+// 过滤条件与各加密方式的key
+struct DecodeOptions {
+    int32_t minLevel;
+    std::string startTime;
+    std::string endTime;
+    size_t threadCnt;
+    std::map<int32_t, std::shared_ptr<baseEncrypt>> encryptTools;
+};
+
+// 日志文件中连续的一段：加密的批次帧，或者未开启加密时写入的明文行
+struct DecodeSegment {
+    const char* data;
+    size_t len;
+    bool framed;
+    LogFrameHeader header;
+};
+
+static void usage(const char* name) {
+    fprintf(stderr,
+            "usage: %s [options] file...\n"
+            "  file        日志文件或compressLogs生成的zip，多个文件按参数顺序输出\n"
+            "  -x key      xor的key，默认%s\n"
+            "  -b key      blowfish的key，默认%s\n"
+            "  -a key      aes的key，默认%s\n"
+            "  -l level    只输出不低于该级别的日志，T/I/W/E\n"
+            "  -s time     只输出不早于该时间的日志，如\"2020-11-08 10:00:00\"\n"
+            "  -e time     只输出早于该时间的日志\n"
+            "  -j threads  解码线程数，默认为CPU核数\n",
+            name, defaultXorEncryptKey, defaultBlowfishEncryptKey, defaultAesEncryptKey);
+}
+
+static void setTool(DecodeOptions& options, int32_t type, baseEncrypt* tool,
+                    const std::string& key) {
+    options.encryptTools[type] = std::shared_ptr<baseEncrypt>(tool);
+    options.encryptTools[type]->setKey((const unsigned char*)key.c_str(), key.size());
+}
+
+// 按日志头过滤：时间在行首，级别字符在"[pid:ptr] "之后，格式不符的行原样保留
+static bool matchFilter(const char* line, size_t len, const DecodeOptions& options) {
+    if (!options.startTime.empty()) {
+        size_t n = std::min(len, options.startTime.size());
+        if (memcmp(line, options.startTime.c_str(), n) < 0) {
+            return false;
+        }
+    }
+    if (!options.endTime.empty()) {
+        size_t n = std::min(len, options.endTime.size());
+        if (memcmp(line, options.endTime.c_str(), n) >= 0) {
+            return false;
+        }
+    }
+    if (options.minLevel > 0) {
+        const char* end = line + len;
+        const char* p = (const char*)memchr(line, '[', len);
+        p = p ? (const char*)memchr(p, ']', end - p) : NULL;
+        if (p && p + 3 < end && ' ' == p[1] && ' ' == p[3]) {
+            const char* level = strchr(kDecodeLevelChars, p[2]);
+            if (level && *level && level - kDecodeLevelChars < options.minLevel) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void appendLine(std::string& out, const char* line, size_t len,
+                       const DecodeOptions& options) {
+    if (matchFilter(line, len, options)) {
+        out.append(line, len);
+        out.push_back('\n');
+    }
+}
+
+// 切分一个文件的内容，明文区段在下一个帧头或kDecodePlainChunk附近的行尾处截断
+static void scanSegments(const char* data, size_t len, const std::string& name,
+                         std::vector<DecodeSegment>& segments) {
+    size_t pos = 0;
+    while (pos < len) {
+        DecodeSegment segment;
+        segment.data = data + pos;
+        if (decodeLogFrameHeader(data + pos, len - pos, segment.header)) {
+            size_t frameLen = kLogFrameHeaderLen + (size_t)segment.header.payloadLen;
+            if (frameLen > len - pos) {
+                fprintf(stderr, "%s [ERROR] %s-%d %s truncated frame at %zu\n",
+                        Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__,
+                        name.c_str(), pos);
+                return;
+            }
+            segment.len = frameLen;
+            segment.framed = true;
+            segments.push_back(segment);
+            pos += frameLen;
+            continue;
+        }
+
+        size_t limit = std::min(len - pos, (size_t)kDecodePlainChunk);
+        size_t end = pos + limit;
+        const char* magic = (const char*)memmem(data + pos, limit, "\n" kLogFrameMagic,
+                                                kLogFrameMagicLen + 1);
+        if (magic) {
+            end = magic - data + 1;
+        } else if (end < len) {
+            const char* newline = (const char*)memrchr(data + pos, '\n', limit);
+            if (newline) {
+                end = newline - data + 1;
+            }
+        }
+        segment.len = end - pos;
+        segment.framed = false;
+        segments.push_back(segment);
+        pos = end;
+    }
+}
+
+static void decodeSegment(const DecodeSegment& segment, const DecodeOptions& options,
+                          std::string& payload, std::string& out) {
+    if (!segment.framed) {
+        const char* line = segment.data;
+        const char* end = segment.data + segment.len;
+        while (line < end) {
+            const char* newline = (const char*)memchr(line, '\n', end - line);
+            const char* lineEnd = newline ? newline : end;
+            if (lineEnd > line) {
+                appendLine(out, line, lineEnd - line, options);
+            }
+            line = lineEnd + 1;
+        }
+        return;
+    }
+
+    const LogFrameHeader& header = segment.header;
+    const char* body = segment.data + kLogFrameHeaderLen;
+    if (ET_NO_ENCRYPTION != header.encType) {
+        std::map<int32_t, std::shared_ptr<baseEncrypt>>::const_iterator it =
+            options.encryptTools.find(header.encType);
+        if (it == options.encryptTools.end()) {
+            fprintf(stderr, "%s [ERROR] %s-%d unknown encrypt type %d\n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__,
+                    (int)header.encType);
+            return;
+        }
+        payload.resize(header.payloadLen);
+        it->second->cryptStream((unsigned char*)&payload[0], (const unsigned char*)body,
+                                (int)header.payloadLen, header.iv, 0);
+        body = payload.data();
+    }
+
+    size_t offset = 0;
+    for (uint32_t i = 0; i < header.recordCnt; ++i) {
+        if (offset + kLogFrameLenSize > header.payloadLen) {
+            break;
+        }
+        uint32_t recordLen = getLogFrameU32(body + offset);
+        offset += kLogFrameLenSize;
+        if (recordLen > header.payloadLen - offset) {
+            // 长度越界说明key不对或者数据损坏，放弃这一帧剩余的内容
+            fprintf(stderr, "%s [ERROR] %s-%d bad record length, wrong key?\n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__);
+            break;
+        }
+        appendLine(out, body + offset, recordLen, options);
+        offset += recordLen;
+    }
+}
+
+// 按窗口并行解码：每个线程处理一段连续的区段，输出按原顺序写到stdout
+static void decodeBuffer(const char* data, size_t len, const std::string& name,
+                         const DecodeOptions& options) {
+    std::vector<DecodeSegment> segments;
+    scanSegments(data, len, name, segments);
+
+    size_t begin = 0;
+    while (begin < segments.size()) {
+        size_t end = begin;
+        size_t windowBytes = 0;
+        while (end < segments.size() && (end == begin || windowBytes < kDecodeWindowSize)) {
+            windowBytes += segments[end].len;
+            ++end;
+        }
+
+        size_t threadCnt = std::max(std::min(options.threadCnt, end - begin), (size_t)1);
+        std::vector<size_t> bounds(1, begin);
+        size_t share = windowBytes / threadCnt + 1;
+        size_t acc = 0;
+        for (size_t i = begin; i < end && bounds.size() < threadCnt; ++i) {
+            acc += segments[i].len;
+            if (acc >= share * bounds.size()) {
+                bounds.push_back(i + 1);
+            }
+        }
+        bounds.push_back(end);
+
+        std::vector<std::string> outputs(bounds.size() - 1);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t + 1 < bounds.size(); ++t) {
+            size_t first = bounds[t];
+            size_t last = bounds[t + 1];
+            std::string* out = &outputs[t];
+            workers.push_back(std::thread([&segments, &options, first, last, out]() {
+                std::string payload;
+                for (size_t i = first; i < last; ++i) {
+                    decodeSegment(segments[i], options, payload, *out);
+                }
+            }));
+        }
+        for (size_t t = 0; t < workers.size(); ++t) {
+            workers[t].join();
+            fwrite(outputs[t].data(), 1, outputs[t].size(), stdout);
+        }
+        begin = end;
+    }
+}
+
+static bool decodeZip(const std::string& path, const DecodeOptions& options) {
+    HZIP hz = OpenZip(path.c_str(), 0);
+    if (!hz) {
+        fprintf(stderr, "%s [ERROR] %s-%d open zip %s failed\n",
+                Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, path.c_str());
+        return false;
+    }
+    ZIPENTRY ze;
+    GetZipItem(hz, -1, &ze);
+    int itemCnt = ze.index;
+    for (int i = 0; i < itemCnt; ++i) {
+        if (ZR_OK != GetZipItem(hz, i, &ze) || ze.unc_size <= 0) {
+            continue;
+        }
+        std::string content(ze.unc_size, '\0');
+        if (ZR_OK != UnzipItem(hz, i, &content[0], content.size())) {
+            fprintf(stderr, "%s [ERROR] %s-%d unzip %s in %s failed\n",
+                    Utils::getCurrentSystemTime().c_str(), __FUNCTION__, __LINE__, ze.name,
+                    path.c_str());
+            continue;
+        }
+        decodeBuffer(content.data(), content.size(), ze.name, options);
+    }
+    CloseZip(hz);
+    return true;
+}
+
+static bool decodeFile(const std::string& path, const DecodeOptions& options) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "%s [ERROR] %s-%d open %s failed\n", Utils::getCurrentSystemTime().c_str(),
+                __FUNCTION__, __LINE__, path.c_str());
+        return false;
+    }
+    struct stat st;
+    if (0 != fstat(fd, &st) || st.st_size <= 0) {
+        close(fd);
+        return 0 == st.st_size;
+    }
+    size_t len = (size_t)st.st_size;
+    void* addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == addr) {
+        fprintf(stderr, "%s [ERROR] %s-%d mmap %s failed\n", Utils::getCurrentSystemTime().c_str(),
+                __FUNCTION__, __LINE__, path.c_str());
+        return false;
+    }
+    madvise(addr, len, MADV_SEQUENTIAL);
+
+    const char* data = (const char*)addr;
+    bool ok = true;
+    if (len >= 4 && 0 == memcmp(data, "PK\x03\x04", 4)) {
+        ok = decodeZip(path, options);
+    } else {
+        decodeBuffer(data, len, path, options);
+    }
+    munmap(addr, len);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    std::string keys[] = {defaultXorEncryptKey, defaultBlowfishEncryptKey, defaultAesEncryptKey};
+    DecodeOptions options;
+    options.minLevel = 0;
+    options.threadCnt = std::max(std::thread::hardware_concurrency(), 1u);
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "x:b:a:l:s:e:j:h")) != -1) {
+        switch (opt) {
+            case 'x':
+                keys[0] = optarg;
+                break;
+            case 'b':
+                keys[1] = optarg;
+                break;
+            case 'a':
+                keys[2] = optarg;
+                break;
+            case 'l': {
+                const char* level = strchr(kDecodeLevelChars, optarg[0]);
+                options.minLevel = (level && *level) ? (int32_t)(level - kDecodeLevelChars) : 0;
+                break;
+            }
+            case 's':
+                options.startTime = optarg;
+                break;
+            case 'e':
+                options.endTime = optarg;
+                break;
+            case 'j':
+                options.threadCnt = (size_t)std::max(atoi(optarg), 1);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    setTool(options, ET_XOR_ENCRYPTION, new Xor(), keys[0]);
+    setTool(options, ET_BLOWFISH_ENCRYPTION, new Blowfish(), keys[1]);
+    setTool(options, ET_AES_ENCRYPTION, new Aes(), keys[2]);
+
+    int ret = 0;
+    for (int i = optind; i < argc; ++i) {
+        if (!decodeFile(argv[i], options)) {
+            ret = 1;
+        }
+    }
+    fflush(stdout);
+    return ret;
+}